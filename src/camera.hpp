@@ -26,7 +26,8 @@ public:
       m_fovy{fovy},
       m_aspect{aspect},
       m_near{near},
-      m_far{far}
+      m_far{far},
+      m_dirty{true}
   {
     if (m_pitch > 89.9f || m_pitch < -89.9f)
       throw std::out_of_range{"Camera pitch must be between -89.9 and 89.9 degrees"};
@@ -71,7 +72,7 @@ public:
     mat[1][1] = f;
     mat[2][2] = (-m_far - m_near) / (m_far - m_near);
     mat[2][3] = -1.0f;
-    mat[3][2] = (2.0f * m_far * m_near) / (m_far - m_near);
+    mat[3][2] = -(2.0f * m_far * m_near) / (m_far - m_near);
     return mat;
   }
 
@@ -104,6 +105,7 @@ public:
       throw std::out_of_range{"Camera aspect ratio must be greater than 0"};
 
     m_aspect = aspect;
+    m_dirty = true;
   }
   
   auto move(Movement direction, float distance) -> void {
@@ -119,6 +121,7 @@ public:
       position += m_up * distance;
     if (direction == Movement::down)
       position -= m_up * distance;
+    m_dirty = true;
   }
   
   auto rotate(float yaw, float pitch) -> void {
@@ -129,6 +132,17 @@ public:
     if (m_pitch < -89.9f) m_pitch = -89.9f;
     
     update_vectors();
+    m_dirty = true;
+  }
+
+  // Whether the camera was moved, rotated or given a new aspect ratio since the last
+  // call to clear_dirty(). Writes to position are not tracked.
+  auto dirty() const -> bool {
+    return m_dirty;
+  }
+
+  auto clear_dirty() -> void {
+    m_dirty = false;
   }
   
 private:
@@ -141,6 +155,7 @@ private:
   float m_aspect;
   float m_near;
   float m_far;
+  bool m_dirty;
 
   auto update_vectors() -> void {
     m_front.x = std::sin(radians(m_yaw)) * std::cos(radians(m_pitch));
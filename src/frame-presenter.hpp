@@ -5,11 +5,13 @@
 #include "gl/texture.hpp"
 #include "gl/vertex-array.hpp"
 #include "gl/shader.hpp"
+#include <array>
 #include <vector>
 #include <cstdint>
 
 #include <cassert>
 
+// Draws frames of its size over the whole viewport, stretching them when it is larger
 class FramePresenter {
 public:
   FramePresenter(int width, int height) 
@@ -27,7 +29,9 @@ public:
     glBindTexture(GL_TEXTURE_2D, m_texture.id());
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // frames smaller than the viewport are upscaled
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
     auto vertices = std::array{
       -1.0f, -1.0f, 0.0f, 1.0f,
@@ -59,10 +63,15 @@ public:
     glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
 
     glBindTexture(GL_TEXTURE_2D, m_texture.id());
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, 0); // pixels are packed as 0xRRGGBBAA
 
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
+    draw();
+  }
+
+  // Draws the last presented frame again, without uploading anything
+  auto draw() -> void {
     m_shader.use();
     glBindTexture(GL_TEXTURE_2D, m_texture.id());
     glBindVertexArray(m_vao.id());
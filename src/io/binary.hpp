@@ -0,0 +1,101 @@
+#ifndef IO_BINARY_HPP
+#define IO_BINARY_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Appends trivially copyable values to a byte buffer in native byte order
+class BinaryWriter {
+public:
+  template<typename T>
+  auto write(const T& value) -> void {
+    static_assert(std::is_trivially_copyable_v<T>);
+    m_data.append((const char*)&value, sizeof(T));
+  }
+
+  auto write_bytes(const void* data, std::size_t size) -> void {
+    m_data.append((const char*)data, size);
+  }
+
+  auto write_string(std::string_view str) -> void {
+    write((std::uint32_t)str.size());
+    m_data.append(str);
+  }
+
+  // pads with zeros until the size is a multiple of alignment
+  auto align(std::size_t alignment) -> void {
+    m_data.resize((m_data.size() + alignment - 1) / alignment * alignment, '\0');
+  }
+
+  auto size() const -> std::size_t {
+    return m_data.size();
+  }
+
+  auto data() const -> const std::string& {
+    return m_data;
+  }
+
+private:
+  std::string m_data{};
+};
+
+// Reads values written by BinaryWriter, throwing if the data is too short
+class BinaryReader {
+public:
+  explicit BinaryReader(std::string_view data) : m_data{data}, m_pos{0} {}
+
+  template<typename T>
+  auto read() -> T {
+    static_assert(std::is_trivially_copyable_v<T>);
+    auto value = T{};
+    std::memcpy(&value, take(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  // returns a view into the underlying data
+  auto read_bytes(std::size_t size) -> const char* {
+    return take(size);
+  }
+
+  auto read_string() -> std::string {
+    auto size = read<std::uint32_t>();
+    return std::string{take(size), size};
+  }
+
+  auto align(std::size_t alignment) -> void {
+    auto pos = (m_pos + alignment - 1) / alignment * alignment;
+    take(pos - m_pos);
+  }
+
+  auto pos() const -> std::size_t {
+    return m_pos;
+  }
+
+private:
+  std::string_view m_data;
+  std::size_t m_pos;
+
+  auto take(std::size_t size) -> const char* {
+    if (size > m_data.size() - m_pos)
+      throw std::runtime_error{"Unexpected end of binary data"};
+    auto* ptr = m_data.data() + m_pos;
+    m_pos += size;
+    return ptr;
+  }
+};
+
+// FNV-1a 64-bit hash
+inline auto fnv1a(std::string_view data) -> std::uint64_t {
+  auto hash = std::uint64_t{14695981039346656037ull};
+  for (auto c : data) {
+    hash ^= (unsigned char)c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+#endif // IO_BINARY_HPP
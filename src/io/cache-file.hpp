@@ -0,0 +1,79 @@
+#ifndef IO_CACHE_FILE_HPP
+#define IO_CACHE_FILE_HPP
+
+#include "io/binary.hpp"
+#include "io/mapped-file.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+// Helpers shared by the caches written next to their source files
+
+// A file a cache was built from. The path is relative to the directory of the cache.
+struct CacheSource {
+  std::string path;
+  std::uint64_t size;
+  std::int64_t mtime;
+  std::uint64_t hash;
+};
+
+inline auto describe_source(const std::filesystem::path& dir, const std::string& path) -> CacheSource {
+  auto filepath = dir / path;
+  auto file = MappedFile{filepath.string()};
+  auto mtime = std::filesystem::last_write_time(filepath).time_since_epoch().count();
+  return {path, file.size(), (std::int64_t)mtime, fnv1a(file.view())};
+}
+
+// Whether the source still has the recorded contents. The file is only hashed when
+// its size matches but its modification time does not (e.g. after a fresh checkout).
+inline auto is_current(const CacheSource& source, const std::filesystem::path& dir) -> bool {
+  auto filepath = dir / source.path;
+  auto error = std::error_code{};
+
+  auto size = std::filesystem::file_size(filepath, error);
+  if (error || size != source.size) return false;
+
+  auto mtime = std::filesystem::last_write_time(filepath, error);
+  if (error) return false;
+  if ((std::int64_t)mtime.time_since_epoch().count() == source.mtime) return true;
+
+  return fnv1a(MappedFile{filepath.string()}.view()) == source.hash;
+}
+
+inline auto write_source(BinaryWriter& writer, const CacheSource& source) -> void {
+  writer.write_string(source.path);
+  writer.write(source.size);
+  writer.write(source.mtime);
+  writer.write(source.hash);
+}
+
+inline auto read_source(BinaryReader& reader) -> CacheSource {
+  auto source = CacheSource{};
+  source.path = reader.read_string();
+  source.size = reader.read<std::uint64_t>();
+  source.mtime = reader.read<std::int64_t>();
+  source.hash = reader.read<std::uint64_t>();
+  return source;
+}
+
+// Returns false if the file could not be written. The file is written under a
+// temporary name first so that a partially written cache is never loaded.
+inline auto write_cache_file(const std::string& filepath, std::string_view data) -> bool {
+  auto temp_filepath = filepath + ".tmp";
+  {
+    auto file = std::ofstream{temp_filepath, std::ios::binary | std::ios::trunc};
+    if (!file) return false;
+    file.write(data.data(), (std::streamsize)data.size());
+    if (!file) return false;
+  }
+
+  auto error = std::error_code{};
+  std::filesystem::rename(temp_filepath, filepath, error);
+  if (error) std::filesystem::remove(temp_filepath, error);
+  return !error;
+}
+
+#endif // IO_CACHE_FILE_HPP
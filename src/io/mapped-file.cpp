@@ -0,0 +1,92 @@
+#include "io/mapped-file.hpp"
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filepath) : m_data{nullptr}, m_size{0} {
+  auto file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    throw std::runtime_error{"Could not open file: " + filepath};
+
+  auto size = LARGE_INTEGER{};
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    throw std::runtime_error{"Could not get size of file: " + filepath};
+  }
+
+  m_size = (std::size_t)size.QuadPart;
+  if (m_size == 0) {
+    CloseHandle(file);
+    return;
+  }
+
+  auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (!mapping)
+    throw std::runtime_error{"Could not map file: " + filepath};
+
+  m_data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping); // the view keeps the mapping alive
+  if (!m_data)
+    throw std::runtime_error{"Could not map file: " + filepath};
+}
+
+MappedFile::~MappedFile() {
+  if (m_data) UnmapViewOfFile(m_data);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filepath) : m_data{nullptr}, m_size{0} {
+  auto fd = open(filepath.c_str(), O_RDONLY);
+  if (fd == -1)
+    throw std::runtime_error{"Could not open file: " + filepath};
+
+  struct stat info{};
+  if (fstat(fd, &info) == -1) {
+    close(fd);
+    throw std::runtime_error{"Could not get size of file: " + filepath};
+  }
+
+  m_size = (std::size_t)info.st_size;
+  if (m_size == 0) {
+    close(fd);
+    return;
+  }
+
+  auto* ptr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // the mapping keeps the file alive
+  if (ptr == MAP_FAILED)
+    throw std::runtime_error{"Could not map file: " + filepath};
+
+  m_data = (const char*)ptr;
+}
+
+MappedFile::~MappedFile() {
+  if (m_data) munmap((void*)m_data, m_size);
+}
+
+#endif
+
+MappedFile::MappedFile(MappedFile&& other) noexcept : m_data{other.m_data}, m_size{other.m_size} {
+  other.m_data = nullptr;
+  other.m_size = 0;
+}
+
+auto MappedFile::operator=(MappedFile&& other) noexcept -> MappedFile& {
+  std::swap(m_data, other.m_data);
+  std::swap(m_size, other.m_size);
+  return *this;
+}
@@ -0,0 +1,37 @@
+#ifndef IO_MAPPED_FILE_HPP
+#define IO_MAPPED_FILE_HPP
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file with RAII semantics
+class MappedFile {
+public:
+  explicit MappedFile(const std::string& filepath);
+  MappedFile(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other) noexcept;
+  ~MappedFile();
+
+  auto operator=(const MappedFile&) -> MappedFile& = delete;
+  auto operator=(MappedFile&& other) noexcept -> MappedFile&;
+
+  // nullptr if the file is empty
+  auto data() const -> const char* {
+    return m_data;
+  }
+
+  auto size() const -> std::size_t {
+    return m_size;
+  }
+
+  auto view() const -> std::string_view {
+    return {m_data, m_size};
+  }
+
+private:
+  const char* m_data;
+  std::size_t m_size;
+};
+
+#endif // IO_MAPPED_FILE_HPP
@@ -3,9 +3,14 @@
 #include "frame-presenter.hpp"
 #include "window/window.hpp"
 #include "window/glfw-guard.hpp"
-#include "model/model.hpp"
+#include "model/model-loader.hpp"
+#include "parallel.hpp"
 #include "renderer.hpp"
+#include "resolution-controller.hpp"
+#include "texture-benchmark.hpp"
+#include <algorithm>
 #include <print>
+#include <string_view>
 
 auto create_window(int width, int height) -> Window {
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -20,9 +25,23 @@ auto init_glad() -> void {
     throw std::runtime_error{"Failed to initialize GLAD"};
 }
 
-auto on_framebuffer_size(int width, int height, FramePresenter& presenter) -> void {
+auto on_framebuffer_size(int width, int height, Camera& camera) -> void {
   glViewport(0, 0, width, height);
-  presenter.resize(width, height);
+  if (width > 0 && height > 0)
+    camera.set_aspect((float)width / (float)height);
+}
+
+// Resizes the renderer and the presenter to scale times the framebuffer size, per axis
+auto apply_resolution_scale(float scale, Window& window, Renderer& renderer, FramePresenter& presenter) -> void {
+  int width, height;
+  glfwGetFramebufferSize(window.get(), &width, &height);
+  if (width <= 0 || height <= 0) return; // minimized
+
+  auto render_width = std::max(1, (int)std::lround((float)width * scale));
+  auto render_height = std::max(1, (int)std::lround((float)height * scale));
+  if (render_width == renderer.width() && render_height == renderer.height()) return;
+  renderer.resize(render_width, render_height);
+  presenter.resize(render_width, render_height);
 }
 
 auto on_cursor_pos(const Vec2f& pos, Vec2f& last_pos, bool& reset, Camera& camera) -> void {
@@ -43,7 +62,8 @@ auto on_cursor_pos(const Vec2f& pos, Vec2f& last_pos, bool& reset, Camera& camer
 }
 
 auto process_input(double frame_time, Camera& camera) -> void {
-  auto speed = 2.0f * (float)frame_time;
+  constexpr auto max_step = 0.1; // seconds, the first frame after idling follows a long wait
+  auto speed = 2.0f * (float)std::min(frame_time, max_step);
   if (glfwGetKey(glfwGetCurrentContext(), GLFW_KEY_W) == GLFW_PRESS)
     camera.move(Movement::forward, speed);
   if (glfwGetKey(glfwGetCurrentContext(), GLFW_KEY_S) == GLFW_PRESS)
@@ -58,7 +78,62 @@ auto process_input(double frame_time, Camera& camera) -> void {
     camera.move(Movement::down, speed);
 }
 
-auto main() -> int {
+auto mode_name(RenderMode mode) -> const char* {
+  switch (mode) {
+    case RenderMode::forward: return "forward";
+    case RenderMode::deferred: return "deferred";
+    case RenderMode::visibility: return "visibility buffer";
+  }
+  return "";
+}
+
+auto next_mode(RenderMode mode) -> RenderMode {
+  switch (mode) {
+    case RenderMode::forward: return RenderMode::deferred;
+    case RenderMode::deferred: return RenderMode::visibility;
+    case RenderMode::visibility: return RenderMode::forward;
+  }
+  return RenderMode::forward;
+}
+
+auto next_shading_rate_source(ShadingRateSource source) -> ShadingRateSource {
+  switch (source) {
+    case ShadingRateSource::none: return ShadingRateSource::luminance;
+    case ShadingRateSource::luminance: return ShadingRateSource::foveated;
+    case ShadingRateSource::foveated: return ShadingRateSource::none;
+  }
+  return ShadingRateSource::none;
+}
+
+auto shading_rate_name(ShadingRateSource source) -> const char* {
+  switch (source) {
+    case ShadingRateSource::none: return "";
+    case ShadingRateSource::luminance: return ", luminance VRS";
+    case ShadingRateSource::foveated: return ", foveated VRS";
+  }
+  return "";
+}
+
+// Options:
+//   --tiled-textures                 store the texels of the model's textures in 4x4 tiles
+//   --bench-texture-layout [image]   time sampling the image with each layout and exit
+auto main(int argc, char* argv[]) -> int {
+  auto texture_options = TextureOptions{.page_budget = 512};
+  for (auto i = 1; i < argc; ++i) {
+    auto arg = std::string_view{argv[i]};
+    if (arg == "--tiled-textures") {
+      texture_options.layout = TextureLayout::tiled;
+    }
+    else if (arg == "--bench-texture-layout") {
+      benchmark_texture_layouts(i + 1 < argc ? argv[i + 1] : "../resources/assets/cyber-samurai/LowSet1_baseColor.png");
+      return 0;
+    }
+    else {
+      std::println("Unknown option {}", arg);
+      return 1;
+    }
+  }
+
   auto guard = GlfwGuard{};
   auto window = create_window(800, 600);
   glfwSwapInterval(0);
@@ -70,9 +145,13 @@ auto main() -> int {
   glViewport(0, 0, width, height);
 
   auto renderer = Renderer{width, height};
+  renderer.set_lights({
+    Light{.type = LightType::directional, .direction = normalize(Vec3f{-0.4f, -1.0f, -0.6f}), .color = Vec3f{0.8f}},
+    Light{.type = LightType::point, .position = Vec3f{3.0f, 2.0f, 4.0f}, .color = Vec3f{0.6f, 0.55f, 0.5f}, .range = 6.0f}
+  });
   auto frame_presenter = FramePresenter{width, height};
   auto camera = Camera{{0.0f, 0.0f, 5.0f}, 60.0f, (float)width / height};
-  auto model = Model{"../resources/assets/teapot.obj"};
+  auto model_loader = ModelLoader{"../resources/assets/teapot.obj", texture_options};
 
   std::println("Camera pos: {} {} {}", camera.position.x, camera.position.y, camera.position.z);
   std::println("Camera front: {} {} {}", camera.front().x, camera.front().y, camera.front().z);
@@ -84,7 +163,7 @@ auto main() -> int {
   std::println("v : {} {} {}", v.x, v.y, v.z);
 
   window.set_framebuffer_size_callback([&](GLFWwindow*, int width, int height) {
-    on_framebuffer_size(width, height, frame_presenter);
+    on_framebuffer_size(width, height, camera);
   });
 
   auto last_cursor = Vec2f{-1.0f, -1.0f};
@@ -93,9 +172,32 @@ auto main() -> int {
     on_cursor_pos(Vec2f{(float)xpos, (float)ypos}, last_cursor, reset_cursor, camera);
   });
 
+  auto dynamic_resolution = true; // render below the window size to hold 60 FPS
   window.set_key_callback([&](GLFWwindow* window, int key, int scancode, int action, int mods) {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
       glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+    if (key == GLFW_KEY_M && action == GLFW_PRESS)
+      renderer.set_mode(next_mode(renderer.mode()));
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+      renderer.set_depth_prepass(!renderer.depth_prepass());
+    if (key == GLFW_KEY_O && action == GLFW_PRESS)
+      renderer.set_sort_front_to_back(!renderer.sort_front_to_back());
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+      renderer.set_temporal_reuse(!renderer.temporal_reuse());
+    if (key == GLFW_KEY_V && action == GLFW_PRESS) // variable rate shading, visibility buffer only
+      renderer.set_shading_rate_source(next_shading_rate_source(renderer.shading_rate_source()));
+    if (key == GLFW_KEY_B && action == GLFW_PRESS)
+      renderer.set_checkerboard(!renderer.checkerboard());
+    if (key == GLFW_KEY_4 && action == GLFW_PRESS)
+      renderer.set_multisample(!renderer.multisample());
+    if (key == GLFW_KEY_R && action == GLFW_PRESS)
+      dynamic_resolution = !dynamic_resolution;
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) { // occlusion culling behind the largest meshes
+      if (renderer.occluders().empty())
+        renderer.set_occluders(largest_meshes(model_loader.model().meshes(), 8));
+      else
+        renderer.set_occluders({});
+    }
   });
 
   window.set_mouse_button_callback([&](GLFWwindow* window, int button, int action, int mods) {
@@ -106,17 +208,38 @@ auto main() -> int {
   });
 
   auto frame_monitor = FrameMonitor{1.0};
+  auto resolution = ResolutionController{1.0 / 60.0};
+  auto idle = false; // the last frame changed nothing, so wait for events instead of polling
+  auto waited = false; // the last iteration waited for events, so its time is mostly waiting
 
   while (!glfwWindowShouldClose(window.get())) {
     frame_monitor.update();
-    glfwSetWindowTitle(window.get(), std::format("Rasterizer - {:.0f} FPS", frame_monitor.fps()).c_str());
-
-    glfwPollEvents();
+    if (!waited)
+      resolution.update(frame_monitor.frame_time());
+    apply_resolution_scale(dynamic_resolution ? resolution.scale() : 1.0f, window, renderer, frame_presenter);
+
+    const auto& stats = renderer.stats();
+    glfwSetWindowTitle(window.get(), std::format("Rasterizer - {:.0f} FPS at {}x{} - {}{}{}{} - overdraw {:.2f}, {} fragments shaded, {} pixels reused, {} reshaded, {} reconstructed, {} saved by coarse shading - {} meshes culled, {} off screen - occluders {:.2f} ms, prepass {:.1f} ms, shading {:.1f} ms",
+      frame_monitor.fps(), renderer.width(), renderer.height(), mode_name(renderer.mode()), renderer.depth_prepass() ? " with depth prepass" : "", renderer.multisample() && renderer.mode() == RenderMode::forward ? ", 4x MSAA" : "", renderer.mode() == RenderMode::visibility ? shading_rate_name(renderer.shading_rate_source()) : "", stats.overdraw(), stats.shaded, stats.reused, stats.reshaded, stats.reconstructed, stats.coarse_saved,
+      stats.culled_meshes, stats.off_screen_meshes, stats.occluder_time * 1000.0, stats.prepass_time * 1000.0, stats.shading_time * 1000.0).c_str());
+
+    waited = idle;
+    if (idle)
+      glfwWaitEventsTimeout(0.1); // wakes up regularly to publish loaded models and textures
+    else
+      glfwPollEvents();
     process_input(frame_monitor.frame_time(), camera);
-
-    renderer.render(camera, model);
-    frame_presenter.present(renderer.colorbuffer());
-
+    if (model_loader.poll() && model_loader.done())
+      std::println("Decoded {} textures in {:.3f} s using {} threads", model_loader.texture_count(), model_loader.texture_load_time(), worker_count());
+
+    auto rendered = renderer.render(camera, model_loader.model());
+    camera.clear_dirty();
+    if (rendered)
+      frame_presenter.present(renderer.colorbuffer());
+    else
+      frame_presenter.draw();
+    auto streamed = model_loader.stream_textures(64);
+    idle = !rendered && !streamed;
 
     glfwSwapBuffers(window.get());
   }
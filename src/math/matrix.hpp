@@ -2,6 +2,8 @@
 #define MATH_MATRIX_HPP
 
 #include <array>
+#include <cmath>
+#include <utility>
 #include "math/vector.hpp"
 
 // row-major order
@@ -71,5 +73,34 @@ inline auto operator*(const Vec<T, dim>& v, const Mat<T, dim>& m) -> Vec<T, dim>
   return result;
 }
 
+// Gauss-Jordan elimination with partial pivoting; a singular matrix gives non-finite values
+template<typename T, int dim>
+inline auto inverse(const Mat<T, dim>& m) -> Mat<T, dim> {
+  auto a = m;
+  auto result = identity<T, dim>();
+  for (auto col = 0u; col < dim; ++col) {
+    auto pivot = col;
+    for (auto row = col + 1; row < dim; ++row) {
+      if (std::abs(a[row][col]) > std::abs(a[pivot][col])) pivot = row;
+    }
+    std::swap(a[col], a[pivot]);
+    std::swap(result[col], result[pivot]);
+
+    auto scale = (T)1 / a[col][col];
+    for (auto j = 0u; j < dim; ++j) {
+      a[col][j] *= scale;
+      result[col][j] *= scale;
+    }
+    for (auto row = 0u; row < dim; ++row) {
+      if (row == col) continue;
+      auto factor = a[row][col];
+      for (auto j = 0u; j < dim; ++j) {
+        a[row][j] -= factor * a[col][j];
+        result[row][j] -= factor * result[col][j];
+      }
+    }
+  }
+  return result;
+}
 
 #endif // MATH_MATRIX_HPP
\ No newline at end of file
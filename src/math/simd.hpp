@@ -0,0 +1,219 @@
+#ifndef MATH_SIMD_HPP
+#define MATH_SIMD_HPP
+
+#include "math/vector.hpp"
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATH_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+// Four floats processed together, with SSE2 when available and plain loops otherwise.
+// Used both as one RGBA color and as one value for each of four pixels.
+// Comparisons are lane-wise and return masks: all bits set where true, zero elsewhere.
+class Float4 {
+public:
+#ifdef MATH_SIMD_SSE2
+  explicit Float4(float value = 0.0f) : m_value{_mm_set1_ps(value)} {}
+
+  Float4(float x, float y, float z, float w) : m_value{_mm_setr_ps(x, y, z, w)} {}
+#else
+  explicit Float4(float value = 0.0f) : m_value{value, value, value, value} {}
+
+  Float4(float x, float y, float z, float w) : m_value{x, y, z, w} {}
+#endif
+
+  explicit Float4(const Vec4f& v) : Float4{v.x, v.y, v.z, v.w} {}
+
+  static auto load(const float* values) -> Float4 {
+    auto result = Float4{};
+#ifdef MATH_SIMD_SSE2
+    result.m_value = _mm_loadu_ps(values);
+#else
+    result.m_value = {values[0], values[1], values[2], values[3]};
+#endif
+    return result;
+  }
+
+  // Four 8-bit channels normalized to [0, 1]
+  static auto from_unorm8(const std::uint8_t* values) -> Float4 {
+    auto result = Float4{};
+#ifdef MATH_SIMD_SSE2
+    auto packed = (std::uint32_t)values[0] | (std::uint32_t)values[1] << 8 | (std::uint32_t)values[2] << 16 | (std::uint32_t)values[3] << 24;
+    auto zero = _mm_setzero_si128();
+    auto bytes = _mm_cvtsi32_si128((int)packed);
+    auto ints = _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero);
+    result.m_value = _mm_mul_ps(_mm_cvtepi32_ps(ints), _mm_set1_ps(1.0f / 255.0f));
+#else
+    for (auto i = 0u; i < 4; ++i)
+      result.m_value[i] = values[i] * (1.0f / 255.0f);
+#endif
+    return result;
+  }
+
+  auto store(float* values) const -> void {
+#ifdef MATH_SIMD_SSE2
+    _mm_storeu_ps(values, m_value);
+#else
+    for (auto i = 0u; i < 4; ++i) values[i] = m_value[i];
+#endif
+  }
+
+  auto operator[](unsigned index) const -> float {
+    assert(index < 4);
+    auto values = std::array<float, 4>{};
+    store(values.data());
+    return values[index];
+  }
+
+  auto to_vec4() const -> Vec4f {
+    auto values = std::array<float, 4>{};
+    store(values.data());
+    return Vec4f{values[0], values[1], values[2], values[3]};
+  }
+
+#ifdef MATH_SIMD_SSE2
+  friend auto operator+(Float4 a, Float4 b) -> Float4 { return Float4{_mm_add_ps(a.m_value, b.m_value)}; }
+  friend auto operator-(Float4 a, Float4 b) -> Float4 { return Float4{_mm_sub_ps(a.m_value, b.m_value)}; }
+  friend auto operator*(Float4 a, Float4 b) -> Float4 { return Float4{_mm_mul_ps(a.m_value, b.m_value)}; }
+  friend auto operator/(Float4 a, Float4 b) -> Float4 { return Float4{_mm_div_ps(a.m_value, b.m_value)}; }
+  friend auto min(Float4 a, Float4 b) -> Float4 { return Float4{_mm_min_ps(a.m_value, b.m_value)}; }
+  friend auto max(Float4 a, Float4 b) -> Float4 { return Float4{_mm_max_ps(a.m_value, b.m_value)}; }
+  friend auto sqrt(Float4 a) -> Float4 { return Float4{_mm_sqrt_ps(a.m_value)}; }
+
+  friend auto operator<(Float4 a, Float4 b) -> Float4 { return Float4{_mm_cmplt_ps(a.m_value, b.m_value)}; }
+  friend auto operator<=(Float4 a, Float4 b) -> Float4 { return Float4{_mm_cmple_ps(a.m_value, b.m_value)}; }
+  friend auto operator>(Float4 a, Float4 b) -> Float4 { return Float4{_mm_cmpgt_ps(a.m_value, b.m_value)}; }
+  friend auto operator>=(Float4 a, Float4 b) -> Float4 { return Float4{_mm_cmpge_ps(a.m_value, b.m_value)}; }
+  friend auto operator==(Float4 a, Float4 b) -> Float4 { return Float4{_mm_cmpeq_ps(a.m_value, b.m_value)}; }
+  friend auto operator&(Float4 a, Float4 b) -> Float4 { return Float4{_mm_and_ps(a.m_value, b.m_value)}; }
+  friend auto operator|(Float4 a, Float4 b) -> Float4 { return Float4{_mm_or_ps(a.m_value, b.m_value)}; }
+
+  // a where mask is set, b elsewhere
+  friend auto select(Float4 mask, Float4 a, Float4 b) -> Float4 {
+    return Float4{_mm_or_ps(_mm_and_ps(mask.m_value, a.m_value), _mm_andnot_ps(mask.m_value, b.m_value))};
+  }
+
+  // Bit i is set if lane i of mask is set
+  friend auto mask_bits(Float4 mask) -> unsigned { return (unsigned)_mm_movemask_ps(mask.m_value); }
+#else
+  friend auto operator+(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return x + y; }); }
+  friend auto operator-(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return x - y; }); }
+  friend auto operator*(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return x * y; }); }
+  friend auto operator/(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return x / y; }); }
+  friend auto min(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return x < y ? x : y; }); }
+  friend auto max(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return x > y ? x : y; }); }
+  friend auto sqrt(Float4 a) -> Float4 { return apply(a, a, [](float x, float) { return std::sqrt(x); }); }
+
+  friend auto operator<(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return to_mask(x < y); }); }
+  friend auto operator<=(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return to_mask(x <= y); }); }
+  friend auto operator>(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return to_mask(x > y); }); }
+  friend auto operator>=(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return to_mask(x >= y); }); }
+  friend auto operator==(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return to_mask(x == y); }); }
+  friend auto operator&(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return bits(x) & bits(y); }); }
+  friend auto operator|(Float4 a, Float4 b) -> Float4 { return apply(a, b, [](float x, float y) { return bits(x) | bits(y); }); }
+
+  // a where mask is set, b elsewhere
+  friend auto select(Float4 mask, Float4 a, Float4 b) -> Float4 {
+    auto result = Float4{};
+    for (auto i = 0u; i < 4; ++i)
+      result.m_value[i] = std::bit_cast<std::uint32_t>(mask.m_value[i]) ? a.m_value[i] : b.m_value[i];
+    return result;
+  }
+
+  // Bit i is set if lane i of mask is set
+  friend auto mask_bits(Float4 mask) -> unsigned {
+    auto result = 0u;
+    for (auto i = 0u; i < 4; ++i)
+      result |= (std::bit_cast<std::uint32_t>(mask.m_value[i]) >> 31) << i;
+    return result;
+  }
+#endif
+
+  friend auto operator*(Float4 a, float b) -> Float4 { return a * Float4{b}; }
+  friend auto operator+=(Float4& a, Float4 b) -> Float4& { return a = a + b; }
+  friend auto operator*=(Float4& a, Float4 b) -> Float4& { return a = a * b; }
+
+private:
+#ifdef MATH_SIMD_SSE2
+  __m128 m_value;
+
+  explicit Float4(__m128 value) : m_value{value} {}
+#else
+  std::array<float, 4> m_value;
+
+  static auto bits(float value) -> std::uint32_t {
+    return std::bit_cast<std::uint32_t>(value);
+  }
+
+  static auto to_mask(bool value) -> std::uint32_t {
+    return value ? ~0u : 0u;
+  }
+
+  // op returns either a float or the bits of one
+  template<typename Op>
+  static auto apply(Float4 a, Float4 b, Op op) -> Float4 {
+    auto result = Float4{};
+    for (auto i = 0u; i < 4; ++i) {
+      auto value = op(a.m_value[i], b.m_value[i]);
+      if constexpr (std::is_same_v<decltype(value), float>)
+        result.m_value[i] = value;
+      else
+        result.m_value[i] = std::bit_cast<float>(value);
+    }
+    return result;
+  }
+#endif
+};
+
+// a + (b - a) * t
+inline auto lerp(Float4 a, Float4 b, Float4 t) -> Float4 {
+  return a + (b - a) * t;
+}
+
+// Four 3D vectors stored component-wise, e.g. the normals of four pixels
+struct Vec3x4 {
+  Float4 x{};
+  Float4 y{};
+  Float4 z{};
+
+  Vec3x4() = default;
+
+  Vec3x4(Float4 x, Float4 y, Float4 z) : x{x}, y{y}, z{z} {}
+
+  // the same vector in every lane
+  explicit Vec3x4(const Vec3f& v) : x{v.x}, y{v.y}, z{v.z} {}
+
+  friend auto operator+(const Vec3x4& a, const Vec3x4& b) -> Vec3x4 { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+  friend auto operator-(const Vec3x4& a, const Vec3x4& b) -> Vec3x4 { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+  friend auto operator*(const Vec3x4& a, const Vec3x4& b) -> Vec3x4 { return {a.x * b.x, a.y * b.y, a.z * b.z}; }
+  friend auto operator*(const Vec3x4& a, Float4 b) -> Vec3x4 { return {a.x * b, a.y * b, a.z * b}; }
+  friend auto operator+=(Vec3x4& a, const Vec3x4& b) -> Vec3x4& { return a = a + b; }
+};
+
+inline auto dot(const Vec3x4& a, const Vec3x4& b) -> Float4 {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline auto cross(const Vec3x4& a, const Vec3x4& b) -> Vec3x4 {
+  return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+// Zero-length vectors stay zero
+inline auto normalize(const Vec3x4& v) -> Vec3x4 {
+  auto length2 = dot(v, v);
+  auto inv_length = select(length2 > Float4{0.0f}, Float4{1.0f} / sqrt(length2), Float4{0.0f});
+  return v * inv_length;
+}
+
+inline auto select(Float4 mask, const Vec3x4& a, const Vec3x4& b) -> Vec3x4 {
+  return {select(mask, a.x, b.x), select(mask, a.y, b.y), select(mask, a.z, b.z)};
+}
+
+#endif // MATH_SIMD_HPP
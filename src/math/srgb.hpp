@@ -0,0 +1,41 @@
+#ifndef MATH_SRGB_HPP
+#define MATH_SRGB_HPP
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Conversions between sRGB-encoded and linear color channels in [0, 1]
+
+inline auto srgb_to_linear(float value) -> float {
+  return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+inline auto linear_to_srgb(float value) -> float {
+  return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// Linear value of every sRGB-encoded byte
+inline const auto srgb_decode_table = [] {
+  auto table = std::array<float, 256>{};
+  for (auto i = 0u; i < 256; ++i)
+    table[i] = srgb_to_linear((float)i / 255.0f);
+  return table;
+}();
+
+// sRGB-encoded byte of linear values quantized to 12 bits, so encoding is a lookup
+constexpr auto srgb_encode_steps = 4096u;
+inline const auto srgb_encode_table = [] {
+  auto table = std::array<std::uint8_t, srgb_encode_steps>{};
+  for (auto i = 0u; i < srgb_encode_steps; ++i)
+    table[i] = (std::uint8_t)std::lround(linear_to_srgb((float)i / (float)(srgb_encode_steps - 1)) * 255.0f);
+  return table;
+}();
+
+/// @param value linear, in [0, 1]
+inline auto encode_srgb(float value) -> std::uint8_t {
+  return srgb_encode_table[(std::size_t)(value * (float)(srgb_encode_steps - 1) + 0.5f)];
+}
+
+#endif // MATH_SRGB_HPP
@@ -0,0 +1,183 @@
+#ifndef MODEL_BLOCK_COMPRESSION_HPP
+#define MODEL_BLOCK_COMPRESSION_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+// BC1 and BC3 (DXT1 and DXT5) encoding and decoding of 4x4 texel blocks.
+// Blocks are given and returned as 16 RGBA8 texels, row by row.
+
+using RgbaBlock = std::array<std::uint8_t, 64>;
+
+constexpr auto bc1_block_size = 8u;
+constexpr auto bc3_block_size = 16u;
+
+inline auto pack_565(int r, int g, int b) -> std::uint16_t {
+  return (std::uint16_t)((r * 31 + 127) / 255 << 11 | (g * 63 + 127) / 255 << 5 | (b * 31 + 127) / 255);
+}
+
+inline auto unpack_565(std::uint16_t color) -> std::array<int, 3> {
+  auto r = color >> 11 & 31;
+  auto g = color >> 5 & 63;
+  auto b = color & 31;
+  return {r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2};
+}
+
+// The four colors of a block in four-color mode (color0 > color1) or three colors
+// and transparent black otherwise. BC3 color blocks are always in four-color mode.
+inline auto bc1_palette(std::uint16_t color0, std::uint16_t color1, bool four_colors) -> std::array<std::array<int, 4>, 4> {
+  auto c0 = unpack_565(color0);
+  auto c1 = unpack_565(color1);
+  auto palette = std::array<std::array<int, 4>, 4>{};
+  for (auto ch = 0u; ch < 3; ++ch) {
+    palette[0][ch] = c0[ch];
+    palette[1][ch] = c1[ch];
+    if (four_colors) {
+      palette[2][ch] = (2 * c0[ch] + c1[ch]) / 3;
+      palette[3][ch] = (c0[ch] + 2 * c1[ch]) / 3;
+    }
+    else {
+      palette[2][ch] = (c0[ch] + c1[ch]) / 2;
+      palette[3][ch] = 0;
+    }
+  }
+  palette[0][3] = palette[1][3] = palette[2][3] = 255;
+  palette[3][3] = four_colors ? 255 : 0;
+  return palette;
+}
+
+inline auto write_u16(std::uint8_t* out, std::uint16_t value) -> void {
+  out[0] = (std::uint8_t)(value & 0xff);
+  out[1] = (std::uint8_t)(value >> 8);
+}
+
+inline auto read_u16(const std::uint8_t* in) -> std::uint16_t {
+  return (std::uint16_t)(in[0] | in[1] << 8);
+}
+
+// Opaque color block. Endpoints are the corners of the block's color bounding box,
+// inset a little and oriented along the diagonal the colors correlate with.
+inline auto encode_bc1_block(const RgbaBlock& texels, std::uint8_t* out) -> void {
+  auto low = std::array{255, 255, 255};
+  auto high = std::array{0, 0, 0};
+  auto mean = std::array{0, 0, 0};
+  for (auto i = 0u; i < 16; ++i) {
+    for (auto ch = 0u; ch < 3; ++ch) {
+      low[ch] = std::min<int>(low[ch], texels[i * 4 + ch]);
+      high[ch] = std::max<int>(high[ch], texels[i * 4 + ch]);
+      mean[ch] += texels[i * 4 + ch];
+    }
+  }
+
+  // flip red and blue endpoints if they correlate negatively with green
+  auto covariance_rg = 0;
+  auto covariance_bg = 0;
+  for (auto i = 0u; i < 16; ++i) {
+    auto g = texels[i * 4 + 1] * 16 - mean[1];
+    covariance_rg += (texels[i * 4 + 0] * 16 - mean[0]) * g;
+    covariance_bg += (texels[i * 4 + 2] * 16 - mean[2]) * g;
+  }
+  if (covariance_rg < 0) std::swap(low[0], high[0]);
+  if (covariance_bg < 0) std::swap(low[2], high[2]);
+
+  for (auto ch = 0u; ch < 3; ++ch) {
+    auto inset = (high[ch] - low[ch]) / 16;
+    low[ch] += inset;
+    high[ch] -= inset;
+  }
+
+  // four-color mode needs color0 > color1; indices are chosen against the final order
+  auto color0 = pack_565(high[0], high[1], high[2]);
+  auto color1 = pack_565(low[0], low[1], low[2]);
+  if (color0 < color1) std::swap(color0, color1);
+
+  auto indices = std::uint32_t{0};
+  if (color0 != color1) {
+    auto palette = bc1_palette(color0, color1, true);
+    for (auto i = 0u; i < 16; ++i) {
+      auto best = 0u;
+      auto best_distance = INT32_MAX;
+      for (auto p = 0u; p < 4; ++p) {
+        auto distance = 0;
+        for (auto ch = 0u; ch < 3; ++ch) {
+          auto d = texels[i * 4 + ch] - palette[p][ch];
+          distance += d * d;
+        }
+        if (distance < best_distance) {
+          best_distance = distance;
+          best = p;
+        }
+      }
+      indices |= best << (2 * i);
+    }
+  }
+
+  write_u16(out, color0);
+  write_u16(out + 2, color1);
+  for (auto i = 0u; i < 4; ++i)
+    out[4 + i] = (std::uint8_t)(indices >> (8 * i));
+}
+
+// Alpha block: 8 interpolated values between the block's minimum and maximum alpha
+inline auto encode_alpha_block(const RgbaBlock& texels, std::uint8_t* out) -> void {
+  auto low = 255;
+  auto high = 0;
+  for (auto i = 0u; i < 16; ++i) {
+    low = std::min<int>(low, texels[i * 4 + 3]);
+    high = std::max<int>(high, texels[i * 4 + 3]);
+  }
+
+  out[0] = (std::uint8_t)high;
+  out[1] = (std::uint8_t)low;
+  auto indices = std::uint64_t{0};
+  if (high != low) {
+    for (auto i = 0u; i < 16; ++i) {
+      // position between high (0) and low (7), mapped to the index order 0, 2, 3, 4, 5, 6, 7, 1
+      auto t = ((high - texels[i * 4 + 3]) * 7 + (high - low) / 2) / (high - low);
+      auto index = t == 0 ? 0 : t == 7 ? 1 : t + 1;
+      indices |= (std::uint64_t)index << (3 * i);
+    }
+  }
+  for (auto i = 0u; i < 6; ++i)
+    out[2 + i] = (std::uint8_t)(indices >> (8 * i));
+}
+
+inline auto encode_bc3_block(const RgbaBlock& texels, std::uint8_t* out) -> void {
+  encode_alpha_block(texels, out);
+  encode_bc1_block(texels, out + 8);
+}
+
+inline auto decode_color_block(const std::uint8_t* in, RgbaBlock& texels, bool four_colors) -> void {
+  auto palette = bc1_palette(read_u16(in), read_u16(in + 2), four_colors);
+  for (auto i = 0u; i < 16; ++i) {
+    auto index = (unsigned)(in[4 + i / 4] >> (2 * (i % 4)) & 3);
+    for (auto ch = 0u; ch < 4; ++ch)
+      texels[i * 4 + ch] = (std::uint8_t)palette[index][ch];
+  }
+}
+
+inline auto decode_bc1_block(const std::uint8_t* in, RgbaBlock& texels) -> void {
+  decode_color_block(in, texels, read_u16(in) > read_u16(in + 2));
+}
+
+inline auto decode_bc3_block(const std::uint8_t* in, RgbaBlock& texels) -> void {
+  decode_color_block(in + 8, texels, true);
+
+  auto a0 = (int)in[0];
+  auto a1 = (int)in[1];
+  auto alphas = std::array<int, 8>{a0, a1};
+  for (auto i = 2; i < 8; ++i) {
+    alphas[(unsigned)i] = a0 > a1
+      ? ((8 - i) * a0 + (i - 1) * a1) / 7
+      : i < 6 ? ((6 - i) * a0 + (i - 1) * a1) / 5 : i == 6 ? 0 : 255;
+  }
+
+  auto indices = std::uint64_t{0};
+  for (auto i = 0u; i < 6; ++i)
+    indices |= (std::uint64_t)in[2 + i] << (8 * i);
+  for (auto i = 0u; i < 16; ++i)
+    texels[i * 4 + 3] = (std::uint8_t)alphas[indices >> (3 * i) & 7];
+}
+
+#endif // MODEL_BLOCK_COMPRESSION_HPP
@@ -0,0 +1,63 @@
+#ifndef MODEL_MESH_HPP
+#define MODEL_MESH_HPP
+
+#include "math/vector.hpp"
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+
+// Blinn-Phong parameters from Ka, Kd, Ks and Ns. A material with metallic-roughness
+// parameters (Pm, Pr or a metallic-roughness map) is shaded with the PBR model
+// instead, using diffuse as its base color.
+struct Material {
+  Vec3f ambient{0.1f};
+  Vec3f diffuse{1.0f};
+  Vec3f specular{1.0f};
+  float shininess{32.0f};
+  Vec3f emission{0.0f};
+  float metallic{0.0f}; // defaults to 1 with a metallic-roughness map, which scales both factors
+  float roughness{1.0f};
+  bool pbr{false};
+  std::optional<std::string> diffuse_texture{};
+  std::optional<std::string> normal_texture{}; // tangent space
+  std::optional<std::string> metallic_roughness_texture{}; // roughness in green, metallic in blue
+  std::optional<std::string> emissive_texture{};
+};
+
+struct Vertex {
+  Vec3f position{};
+  Vec3f normal{};
+  Vec2f uv{};
+  Vec4f tangent{}; // direction of increasing u, w is the sign of the bitangent (v direction)
+};
+
+// Axis-aligned bounding box. Empty when min > max.
+struct Bounds {
+  Vec3f min{std::numeric_limits<float>::max()};
+  Vec3f max{std::numeric_limits<float>::lowest()};
+
+  auto empty() const -> bool {
+    return min.x > max.x;
+  }
+
+  auto extend(const Vec3f& point) -> void {
+    min = Vec3f{std::min(min.x, point.x), std::min(min.y, point.y), std::min(min.z, point.z)};
+    max = Vec3f{std::max(max.x, point.x), std::max(max.y, point.y), std::max(max.z, point.z)};
+  }
+
+  auto extend(const Bounds& other) -> void {
+    if (other.empty()) return;
+    extend(other.min);
+    extend(other.max);
+  }
+};
+
+struct Mesh {
+  Material material{};
+  std::span<const Vertex> vertices{}; // owned by the Model
+  Bounds bounds{};
+};
+
+#endif // MODEL_MESH_HPP
@@ -0,0 +1,172 @@
+#ifndef MODEL_MODEL_CACHE_HPP
+#define MODEL_MODEL_CACHE_HPP
+
+#include "io/binary.hpp"
+#include "io/cache-file.hpp"
+#include "io/mapped-file.hpp"
+#include "model/mesh.hpp"
+#include "model/texture.hpp"
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Binary model cache, written next to the source model as "<model>.cache".
+// Layout (native byte order):
+//   header:    magic "RMDL", u32 version, u32 sizeof(Vertex)
+//   sources:   u32 count, then per source: string path, u64 size, i64 mtime, u64 hash
+//   textures:  u32 count, then per texture: string name, u8 color space
+//   meshes:    u32 count, then per mesh: material, bounds, u64 vertex offset, u64 vertex count
+//   vertices:  aligned to 16 bytes, the vertex blob of every mesh
+// Strings are a u32 length followed by the characters. Vertex offsets are relative to
+// the start of the vertex blobs, which are used in place from the mapped file.
+
+constexpr auto model_cache_magic = std::array{'R', 'M', 'D', 'L'};
+constexpr auto model_cache_version = std::uint32_t{3};
+constexpr auto model_cache_alignment = std::size_t{16};
+
+inline auto write_optional_string(BinaryWriter& writer, const std::optional<std::string>& str) -> void {
+  writer.write((std::uint8_t)str.has_value());
+  if (str) writer.write_string(*str);
+}
+
+inline auto read_optional_string(BinaryReader& reader) -> std::optional<std::string> {
+  if (!reader.read<std::uint8_t>()) return {};
+  return reader.read_string();
+}
+
+inline auto write_material(BinaryWriter& writer, const Material& material) -> void {
+  writer.write(material.ambient);
+  writer.write(material.diffuse);
+  writer.write(material.specular);
+  writer.write(material.shininess);
+  writer.write(material.emission);
+  writer.write(material.metallic);
+  writer.write(material.roughness);
+  writer.write((std::uint8_t)material.pbr);
+  write_optional_string(writer, material.diffuse_texture);
+  write_optional_string(writer, material.normal_texture);
+  write_optional_string(writer, material.metallic_roughness_texture);
+  write_optional_string(writer, material.emissive_texture);
+}
+
+inline auto read_material(BinaryReader& reader) -> Material {
+  auto material = Material{};
+  material.ambient = reader.read<Vec3f>();
+  material.diffuse = reader.read<Vec3f>();
+  material.specular = reader.read<Vec3f>();
+  material.shininess = reader.read<float>();
+  material.emission = reader.read<Vec3f>();
+  material.metallic = reader.read<float>();
+  material.roughness = reader.read<float>();
+  material.pbr = reader.read<std::uint8_t>() != 0;
+  material.diffuse_texture = read_optional_string(reader);
+  material.normal_texture = read_optional_string(reader);
+  material.metallic_roughness_texture = read_optional_string(reader);
+  material.emissive_texture = read_optional_string(reader);
+  return material;
+}
+
+// Returns false if the cache could not be written
+inline auto write_model_cache(const std::string& filepath, const std::vector<CacheSource>& sources, const std::vector<TextureRef>& textures, const std::vector<Mesh>& meshes) -> bool {
+  auto writer = BinaryWriter{};
+  writer.write(model_cache_magic);
+  writer.write(model_cache_version);
+  writer.write((std::uint32_t)sizeof(Vertex));
+
+  writer.write((std::uint32_t)sources.size());
+  for (const auto& source : sources)
+    write_source(writer, source);
+
+  writer.write((std::uint32_t)textures.size());
+  for (const auto& texture : textures) {
+    writer.write_string(texture.name);
+    writer.write((std::uint8_t)texture.color_space);
+  }
+
+  writer.write((std::uint32_t)meshes.size());
+  auto offset = std::uint64_t{0};
+  for (const auto& mesh : meshes) {
+    write_material(writer, mesh.material);
+    writer.write(mesh.bounds);
+    writer.write(offset);
+    writer.write((std::uint64_t)mesh.vertices.size());
+    offset += mesh.vertices.size_bytes();
+  }
+
+  writer.align(model_cache_alignment);
+  for (const auto& mesh : meshes)
+    writer.write_bytes(mesh.vertices.data(), mesh.vertices.size_bytes());
+
+  return write_cache_file(filepath, writer.data());
+}
+
+struct ModelCache {
+  MappedFile file;
+  std::vector<Mesh> meshes; // vertices point into file
+  std::vector<TextureRef> textures;
+};
+
+// Returns none if there is no cache, it is from another version, any of its sources
+// changed, or it is malformed
+inline auto read_model_cache(const std::string& filepath, const std::filesystem::path& dir) -> std::optional<ModelCache> {
+  auto error = std::error_code{};
+  if (!std::filesystem::exists(filepath, error)) return {};
+
+  try {
+    auto file = MappedFile{filepath};
+    auto reader = BinaryReader{file.view()};
+
+    if (reader.read<decltype(model_cache_magic)>() != model_cache_magic) return {};
+    if (reader.read<std::uint32_t>() != model_cache_version) return {};
+    if (reader.read<std::uint32_t>() != sizeof(Vertex)) return {};
+
+    auto source_count = reader.read<std::uint32_t>();
+    for (auto i = 0u; i < source_count; ++i) {
+      if (!is_current(read_source(reader), dir)) return {};
+    }
+
+    auto textures = std::vector<TextureRef>(reader.read<std::uint32_t>());
+    for (auto& texture : textures) {
+      texture.name = reader.read_string();
+      texture.color_space = reader.read<std::uint8_t>() ? ColorSpace::linear : ColorSpace::srgb;
+    }
+
+    struct Blob {
+      std::uint64_t offset;
+      std::uint64_t count;
+    };
+
+    auto meshes = std::vector<Mesh>(reader.read<std::uint32_t>());
+    auto blobs = std::vector<Blob>(meshes.size());
+    for (auto i = 0u; i < meshes.size(); ++i) {
+      meshes[i].material = read_material(reader);
+      meshes[i].bounds = reader.read<Bounds>();
+      blobs[i].offset = reader.read<std::uint64_t>();
+      blobs[i].count = reader.read<std::uint64_t>();
+    }
+
+    reader.align(model_cache_alignment);
+    auto blob_start = reader.pos();
+    auto blob_size = file.size() - blob_start;
+    for (auto i = 0u; i < meshes.size(); ++i) {
+      if (blobs[i].offset % sizeof(Vertex) != 0
+        || blobs[i].offset > blob_size
+        || blobs[i].count > (blob_size - blobs[i].offset) / sizeof(Vertex))
+        return {};
+
+      auto* vertices = (const Vertex*)(file.data() + blob_start + blobs[i].offset);
+      meshes[i].vertices = std::span{vertices, (std::size_t)blobs[i].count};
+    }
+
+    return ModelCache{std::move(file), std::move(meshes), std::move(textures)};
+  }
+  catch (const std::exception&) {
+    return {};
+  }
+}
+
+#endif // MODEL_MODEL_CACHE_HPP
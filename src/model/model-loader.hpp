@@ -0,0 +1,126 @@
+#ifndef MODEL_MODEL_LOADER_HPP
+#define MODEL_MODEL_LOADER_HPP
+
+#include "model/model.hpp"
+#include "timer.hpp"
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+
+// Loads a Model on a worker thread so rendering can start right away.
+// Until the geometry arrives model() is an empty placeholder, and until the textures
+// arrive materials have no texture loaded (Model::find_texture returns nullptr).
+// Finished results only become visible through poll(), which is meant to be called
+// at a frame boundary so a frame never sees a model change halfway through.
+class ModelLoader {
+public:
+  explicit ModelLoader(const std::string& filepath, const TextureOptions& texture_options = {})
+    : m_model{},
+      m_mutex{},
+      m_pending_model{},
+      m_pending_textures{},
+      m_error{},
+      m_geometry_loaded{false},
+      m_textures_loaded{false},
+      m_texture_count{0},
+      m_texture_load_time{0.0},
+      m_worker{[this, filepath, texture_options](std::stop_token stop) { load(filepath, texture_options, stop); }}
+  {}
+
+  ModelLoader(const ModelLoader&) = delete;
+  ModelLoader(ModelLoader&&) = delete;
+
+  auto operator=(const ModelLoader&) -> ModelLoader& = delete;
+  auto operator=(ModelLoader&&) -> ModelLoader& = delete;
+
+  // Publishes the results finished since the last call and rethrows loading errors.
+  // Returns true if model() changed.
+  auto poll() -> bool {
+    auto lock = std::scoped_lock{m_mutex};
+    if (m_error)
+      std::rethrow_exception(std::exchange(m_error, nullptr));
+
+    auto changed = false;
+    if (m_pending_model) {
+      m_model = std::move(*m_pending_model);
+      m_pending_model.reset();
+      m_geometry_loaded = true;
+      changed = true;
+    }
+    if (m_pending_textures && m_geometry_loaded) {
+      m_model.add_textures(std::move(*m_pending_textures));
+      m_pending_textures.reset();
+      m_textures_loaded = true;
+      changed = true;
+    }
+    return changed;
+  }
+
+  auto model() const -> const Model& {
+    return m_model;
+  }
+
+  // See Model::stream_textures
+  auto stream_textures(std::size_t max_loads) -> bool {
+    return m_model.stream_textures(max_loads);
+  }
+
+  // Whether everything has been published
+  auto done() const -> bool {
+    return m_geometry_loaded && m_textures_loaded;
+  }
+
+  // Number of decoded textures, valid once done()
+  auto texture_count() const -> std::size_t {
+    return m_texture_count;
+  }
+
+  // Wall time in seconds spent decoding the textures, valid once done()
+  auto texture_load_time() const -> double {
+    return m_texture_load_time;
+  }
+
+private:
+  Model m_model;
+  std::mutex m_mutex; // guards the pending results and the error
+  std::optional<Model> m_pending_model;
+  std::optional<texture_lib> m_pending_textures;
+  std::exception_ptr m_error;
+  bool m_geometry_loaded;
+  bool m_textures_loaded;
+  std::size_t m_texture_count;
+  double m_texture_load_time;
+  std::jthread m_worker; // declared last so it is joined before the members it uses are destroyed
+
+  auto load(const std::string& filepath, const TextureOptions& texture_options, std::stop_token stop) -> void {
+    try {
+      auto model = Model{filepath, false};
+      auto refs = model.texture_refs();
+      {
+        auto lock = std::scoped_lock{m_mutex};
+        m_pending_model = std::move(model);
+      }
+
+      if (stop.stop_requested()) return;
+
+      auto dir = std::filesystem::path{filepath}.parent_path();
+      auto timer = Timer{};
+      auto textures = decode_textures(dir, refs, texture_options);
+      auto lock = std::scoped_lock{m_mutex};
+      m_texture_load_time = timer.elapsed();
+      m_texture_count = textures.size();
+      m_pending_textures = std::move(textures);
+    }
+    catch (...) {
+      auto lock = std::scoped_lock{m_mutex};
+      m_error = std::current_exception();
+    }
+  }
+};
+
+#endif // MODEL_MODEL_LOADER_HPP
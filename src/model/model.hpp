@@ -1,104 +1,43 @@
 #ifndef MODEL_HPP
 #define MODEL_HPP
 
+#include "io/mapped-file.hpp"
+#include "model/mesh.hpp"
+#include "model/model-cache.hpp"
+#include "model/obj.hpp"
 #include "model/texture.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <span>
 #include <vector>
 #include <string>
 #include <stdexcept>
+#include <optional>
 #include <unordered_map>
 #include <fstream>
+#include <memory>
 #include <filesystem>
+#include <functional>
 #include <sstream>
+#include <system_error>
 
-struct Material {
-  Vec3f ambient{0.1f};
-  Vec3f diffuse{1.0f};
-  Vec3f specular{1.0f};
-  float shininess{32.0f};
-  std::optional<std::string> diffuse_texture;
-};
-
-struct Vertex {
-  Vec3f position;
-  Vec3f normal;
-  Vec2f uv;
-};
-
-struct Mesh {
-  Material material;
-  std::vector<Vertex> vertices;
-};
-
-struct Index {
-  std::uint32_t position;
-  std::optional<std::uint32_t> uv;
-  std::optional<std::uint32_t> normal;
-};
-
-using Face = std::vector<Index>;
-
-/// @param line the face line without prefix "f"
-inline auto parse_face(const std::string& line) -> Face {
-  auto sstream = std::istringstream{line};
-  auto face = Face{};
-  
-  auto token = std::string{};
-  while (sstream >> token) {
-    auto first_slash = token.find('/');
-    auto second_slash = token.find('/', first_slash + 1);
-    auto index = Index{};
-
-    if (first_slash == std::string::npos) {
-      // only position index
-      auto pos = std::stol(token);
-      if (pos < 0) {
-        throw std::runtime_error{"Negative indices are not supported"};
-      }
-      index.position = (std::uint32_t)pos - 1;
-    }
-    else if (second_slash == std::string::npos) {
-      // position and uv indices
-      auto pos = std::stol(token.substr(0, first_slash));
-      auto uv = std::stol(token.substr(first_slash + 1));
-      if (pos < 0 || uv < 0) {
-        throw std::runtime_error{"Negative indices are not supported"};
-      }
-
-      index.position = (std::uint32_t)pos - 1;
-      index.uv = (std::uint32_t)uv - 1;
-    }
-    else {
-      // position, uv, and normal indices
-      auto pos = std::stol(token.substr(0, first_slash));
-      if (pos < 0)
-        throw std::runtime_error{"Negative indices are not supported"};
-      
-      index.position = (std::uint32_t)pos - 1;
-      if (second_slash > first_slash + 1) {
-        auto uv = std::stol(token.substr(first_slash + 1, second_slash - first_slash - 1));
-        if (uv < 0)
-          throw std::runtime_error{"Negative indices are not supported"};
-        index.uv = (std::uint32_t)uv - 1;
-      }
-      if (second_slash < token.size() - 1) {
-        auto nor = std::stoul(token.substr(second_slash + 1));
-        if (nor < 0)
-          throw std::runtime_error{"Negative indices are not supported"};
-        index.normal = (std::uint32_t)nor - 1;
-      }
-    }
-
-    face.push_back(index);
-  }
-
-  if (face.size() < 3 || face.size() > 4)
-    throw std::runtime_error{"Only triangular and quadrilateral faces are supported"};
+using material_lib = std::unordered_map<std::string, Material>;
 
-  return face;
+// Path of a texture map statement: the last token of the line, after any options
+// such as "-bm 1.0"
+inline auto read_map_path(std::istream& file) -> std::string {
+  auto line = std::string{};
+  std::getline(file, line);
+  auto tokens = std::istringstream{line};
+  auto path = std::string{};
+  for (auto token = std::string{}; tokens >> token;)
+    path = token;
+  return path;
 }
 
-using material_lib = std::unordered_map<std::string, Material>;
-
 inline auto parse_mtl(const std::string& filepath) -> material_lib {
   auto file = std::ifstream{filepath};
   if (!file)
@@ -106,6 +45,7 @@ inline auto parse_mtl(const std::string& filepath) -> material_lib {
 
   auto materials = material_lib{};
   auto current_material = std::string{};
+  auto explicit_metallic = std::unordered_map<std::string, bool>{}; // whether Pm was given
 
   while (file) {
     auto token = std::string{};
@@ -133,120 +73,368 @@ inline auto parse_mtl(const std::string& filepath) -> material_lib {
     else if (token == "Ns") {
       file >> materials.at(current_material).shininess;
     }
+    else if (token == "Ke") {
+      file >> materials.at(current_material).emission.x
+          >> materials.at(current_material).emission.y
+          >> materials.at(current_material).emission.z;
+    }
+    else if (token == "Pm") {
+      file >> materials.at(current_material).metallic;
+      materials.at(current_material).pbr = true;
+      explicit_metallic[current_material] = true;
+    }
+    else if (token == "Pr") {
+      file >> materials.at(current_material).roughness;
+      materials.at(current_material).pbr = true;
+    }
     else if (token == "map_Kd") {
-      auto texture_path = std::string{};
-      file >> texture_path;
-      materials.at(current_material).diffuse_texture = texture_path;
+      materials.at(current_material).diffuse_texture = read_map_path(file);
+    }
+    else if (token == "bump" || token == "map_Bump" || token == "map_bump" || token == "norm") {
+      materials.at(current_material).normal_texture = read_map_path(file);
+    }
+    // exporters write glTF metallic-roughness maps under various names
+    else if (token == "map_Pr" || token == "map_Pm" || token == "map_Ns" || token == "refl") {
+      materials.at(current_material).metallic_roughness_texture = read_map_path(file);
+      materials.at(current_material).pbr = true;
+    }
+    else if (token == "map_Ke") {
+      materials.at(current_material).emissive_texture = read_map_path(file);
     }
   }
 
+  // the map scales the factors, and glTF's default metallic factor is 1
+  for (auto& [name, material] : materials) {
+    if (material.metallic_roughness_texture && !explicit_metallic.contains(name))
+      material.metallic = 1.0f;
+  }
   return materials;
 }
 
-class Model {
-public:
-  Model(const std::string& filepath) {
-    auto file = std::ifstream{filepath};
-    if (!file)
-      throw std::runtime_error{"Could not open model file: " + filepath};
+// Mesh vertices emitted by a face: one triangle, or two for a quad
+inline auto assemble_face(const Face& face, const std::vector<Vec3f>& positions, const std::vector<Vec3f>& normals, const std::vector<Vec2f>& uvs, Vertex* out) -> void {
+  for (auto i = 0u; i < face.size; ++i) {
+    const auto& index = face.indices[i];
+    if (index.position >= positions.size()
+      || (index.normal && *index.normal >= normals.size())
+      || (index.uv && *index.uv >= uvs.size()))
+      throw std::runtime_error{"Face index out of range"};
+  }
 
-    auto dir = std::filesystem::path{filepath}.parent_path();
+  auto normal = Vec3f{};
+  if (!face.indices[0].normal) {
+    auto ab = positions[face.indices[1].position] - positions[face.indices[0].position];
+    auto ac = positions[face.indices[2].position] - positions[face.indices[0].position];
+    normal = normalize(cross(ab, ac));
+  }
 
-    auto positions = std::vector<Vec3f>{};
-    auto normals = std::vector<Vec3f>{};
-    auto uvs = std::vector<Vec2f>{};
+  auto vertex = [&](const Index& index) {
+    return Vertex{positions[index.position], index.normal ? normals[*index.normal] : normal, index.uv ? uvs[*index.uv] : Vec2f{}, Vec4f{}};
+  };
 
-    auto materials = std::optional<material_lib>{};
+  out[0] = vertex(face.indices[0]);
+  out[1] = vertex(face.indices[1]);
+  out[2] = vertex(face.indices[2]);
 
-    while (file) {
-      auto token = std::string{};
-      file >> token;
-      if (token == "v") {
-        auto position = Vec3f{};
-        file >> position.x >> position.y >> position.z;
-        positions.push_back(position);
-      } 
-      else if (token == "vn") {
-        auto normal = Vec3f{};
-        file >> normal.x >> normal.y >> normal.z;
-        normals.push_back(normal);
-      }
-      else if (token == "vt") {
-        auto uv = Vec2f{};
-        file >> uv.x >> uv.y;
-        uvs.push_back(uv);
-      }
-      else if (token == "f") {
-        if (m_meshes.empty()) {
-          m_meshes.emplace_back();
-        }
+  if (face.size == 4) {
+    out[3] = out[2];
+    out[4] = vertex(face.indices[3]);
+    out[5] = out[0];
+  }
+}
 
-        std::getline(file, token);
-        auto face = parse_face(token);
+// Sets the tangents of a triangle list from its uv layout, orthogonalized against each
+// vertex normal. Triangles without a uv mapping get an arbitrary tangent.
+inline auto compute_tangents(std::span<Vertex> vertices) -> void {
+  for (auto i = std::size_t{0}; i + 2 < vertices.size(); i += 3) {
+    auto* v = &vertices[i];
+    auto e1 = v[1].position - v[0].position;
+    auto e2 = v[2].position - v[0].position;
+    auto d1 = v[1].uv - v[0].uv;
+    auto d2 = v[2].uv - v[0].uv;
+    auto det = d1.x * d2.y - d2.x * d1.y;
+    auto mapped = std::abs(det) > 1e-12f;
+    auto tangent = mapped ? (e1 * d2.y - e2 * d1.y) / det : Vec3f{};
+    auto bitangent = mapped ? (e2 * d1.x - e1 * d2.x) / det : Vec3f{};
+
+    for (auto k = 0u; k < 3; ++k) {
+      const auto& n = v[k].normal;
+      auto t = tangent - n * dot(n, tangent);
+      if (dot(t, t) < 1e-12f) {
+        // any direction perpendicular to the normal
+        t = std::abs(n.x) < 0.9f ? cross(n, Vec3f{1.0f, 0.0f, 0.0f}) : cross(n, Vec3f{0.0f, 1.0f, 0.0f});
+      }
+      t = normalize(t);
+      v[k].tangent = Vec4f{t, dot(cross(n, t), bitangent) < 0.0f ? -1.0f : 1.0f};
+    }
+  }
+}
 
-        auto normal = Vec3f{};
-        if (!face[0].normal) {
-          auto ab = positions[face[1].position] - positions[face[0].position];
-          auto ac = positions[face[2].position] - positions[face[0].position];
-          normal = normalize(cross(ab, ac));
-        }
+// Concatenates a per-chunk array of every chunk in order
+template<typename T>
+inline auto gather(const std::vector<ObjChunk>& chunks, std::vector<T> ObjChunk::* member) -> std::vector<T> {
+  auto offsets = std::vector<std::size_t>(chunks.size() + 1, 0);
+  for (auto i = 0u; i < chunks.size(); ++i)
+    offsets[i + 1] = offsets[i] + (chunks[i].*member).size();
+
+  auto result = std::vector<T>(offsets.back());
+  parallel_for(chunks.size(), [&](std::size_t i) {
+    std::copy((chunks[i].*member).begin(), (chunks[i].*member).end(), result.begin() + (std::ptrdiff_t)offsets[i]);
+  });
+  return result;
+}
 
-        auto v0 = Vertex{positions[face[0].position], face[0].normal ? normals[*face[0].normal] : normal, face[0].uv ? uvs[*face[0].uv] : Vec2f{}};
-        auto v1 = Vertex{positions[face[1].position], face[1].normal ? normals[*face[1].normal] : normal, face[1].uv ? uvs[*face[1].uv] : Vec2f{}};
-        auto v2 = Vertex{positions[face[2].position], face[2].normal ? normals[*face[2].normal] : normal, face[2].uv ? uvs[*face[2].uv] : Vec2f{}};
+using texture_lib = std::unordered_map<std::string, Texture>;
+
+// Decodes the textures in parallel, largest files first so that a big texture
+// does not start last and keep a single thread busy at the end. Streamed textures
+// share one page pool, so options.page_budget bounds all of them together.
+/// @param refs unique texture paths relative to dir; their color space overrides the one of options
+inline auto decode_textures(const std::filesystem::path& dir, const std::vector<TextureRef>& refs, const TextureOptions& options = {}) -> texture_lib {
+  auto order = std::vector<std::pair<std::uintmax_t, std::size_t>>{}; // file size and index in refs
+  for (auto i = 0u; i < refs.size(); ++i) {
+    auto error = std::error_code{};
+    auto size = std::filesystem::file_size(dir / refs[i].name, error);
+    order.emplace_back(error ? 0 : size, i);
+  }
+  std::sort(order.begin(), order.end(), std::greater{});
+
+  auto page_pool = options.page_budget > 0 ? std::make_shared<PagePool>(options.page_budget) : nullptr;
+  auto decoded = std::vector<std::optional<Texture>>(refs.size());
+  parallel_for(order.size(), [&](std::size_t i) {
+    auto index = order[i].second;
+    auto texture_options = options;
+    texture_options.color_space = refs[index].color_space;
+    decoded[index].emplace((dir / refs[index].name).string(), texture_options, page_pool);
+  });
+
+  auto textures = texture_lib{};
+  for (auto i = 0u; i < refs.size(); ++i)
+    textures.emplace(refs[i].name, std::move(*decoded[i]));
+  return textures;
+}
 
-        m_meshes.back().vertices.push_back(v0);
-        m_meshes.back().vertices.push_back(v1);
-        m_meshes.back().vertices.push_back(v2);
+class Model {
+public:
+  // An empty model
+  Model() = default;
+
+  // Loads the binary cache next to the model if it is up to date. Otherwise the
+  // model is parsed and the cache is rewritten; failing to write it is not an error.
+  // If load_textures is false, only the names of the textures are collected and
+  // the textures can be decoded later and handed over with add_textures().
+  explicit Model(const std::string& filepath, bool load_textures = true, const TextureOptions& texture_options = {}) {
+    auto dir = std::filesystem::path{filepath}.parent_path();
+    auto cache_filepath = filepath + ".cache";
 
-        if (face.size() == 4) {
-          auto v3 = Vertex{positions[face[3].position], face[3].normal ? normals[*face[3].normal] : normal, face[3].uv ? uvs[*face[3].uv] : Vec2f{}};
-          m_meshes.back().vertices.push_back(v2);
-          m_meshes.back().vertices.push_back(v3);
-          m_meshes.back().vertices.push_back(v0);
-        }
-      }
-      else if (token == "usemtl" && materials) {
-        auto material_name = std::string{};
-        file >> material_name;
-        if (!materials->contains(material_name))
-          throw std::runtime_error{"material not found: " + material_name};
-
-        m_meshes.emplace_back();
-        m_meshes.back().material = materials->at(material_name);
-      }
-      else if (token == "mtllib") {
-        auto mtl_filename = std::string{};
-        file >> mtl_filename;
-        auto mtl_filepath = (dir / mtl_filename).string();
-        materials = parse_mtl(mtl_filepath);
-
-        // Load textures for materials
-        for (auto& [_, material] : *materials) {
-          if (!material.diffuse_texture) continue;
-
-          if (!m_textures.contains(*material.diffuse_texture)) {
-            auto texture_filepath = (dir / *material.diffuse_texture).string();
-            m_textures.emplace(*material.diffuse_texture, Texture{texture_filepath});
-          }
-        }
-      }
+    if (auto cache = read_model_cache(cache_filepath, dir)) {
+      m_cache = std::move(cache->file);
+      m_meshes = std::move(cache->meshes);
+      m_texture_refs = std::move(cache->textures);
+    }
+    else {
+      auto sources = parse_obj(filepath);
+      write_model_cache(cache_filepath, sources, m_texture_refs, m_meshes);
     }
+
+    if (load_textures)
+      m_textures = decode_textures(dir, m_texture_refs, texture_options);
   }
 
+  Model(const Model&) = delete;
+  Model(Model&&) = default;
+
+  auto operator=(const Model&) -> Model& = delete;
+  auto operator=(Model&&) -> Model& = default;
+
   auto meshes() const -> const std::vector<Mesh>& {
     return m_meshes;
   }
 
+  auto bounds() const -> Bounds {
+    auto bounds = Bounds{};
+    for (const auto& mesh : m_meshes)
+      bounds.extend(mesh.bounds);
+    return bounds;
+  }
+
   auto texture(const std::string& name) const -> const Texture& {
     if (!m_textures.contains(name))
       throw std::runtime_error{"Texture not found: " + name};
     return m_textures.at(name);
   }
 
+  // nullptr if the texture is not loaded (yet), or is streamed and not ready
+  auto find_texture(const std::string& name) const -> const Texture* {
+    auto it = m_textures.find(name);
+    return it == m_textures.end() || !it->second.ready() ? nullptr : &it->second;
+  }
+
+  // Textures referenced by the materials, relative to the model directory. Color maps
+  // are sRGB encoded, normal and metallic-roughness maps linear.
+  auto texture_refs() const -> const std::vector<TextureRef>& {
+    return m_texture_refs;
+  }
+
+  auto add_textures(texture_lib&& textures) -> void {
+    m_textures.merge(textures);
+    m_version = s_next_version++;
+  }
+
+  // Prepares the streamed textures that are not ready and loads pages that were missing
+  // in the last frame, at most max_loads per page pool. A pool evicts the least recently
+  // used pages of all its textures. Must not run while the model is being rendered.
+  // Returns whether anything was loaded.
+  auto stream_textures(std::size_t max_loads) -> bool {
+    auto textures = std::vector<Texture*>{};
+    for (auto& [name, texture] : m_textures) {
+      if (texture.page_table()) textures.push_back(&texture);
+    }
+    auto prepared = std::vector<char>(textures.size(), false);
+    parallel_for(textures.size(), [&](std::size_t i) { prepared[i] = textures[i]->prepare(); });
+    auto loaded = std::find(prepared.begin(), prepared.end(), true) != prepared.end();
+
+    // textures sharing a pool are updated together
+    std::ranges::sort(textures, {}, &Texture::page_pool);
+    for (auto first = textures.begin(); first != textures.end();) {
+      auto* pool = (*first)->page_pool();
+      auto last = std::find_if(first, textures.end(), [&](const Texture* texture) { return texture->page_pool() != pool; });
+      auto tables = std::vector<PageTable*>{};
+      for (auto it = first; it != last; ++it)
+        tables.push_back((*it)->page_table());
+
+      auto loads = pool->update(tables, max_loads);
+      parallel_for(loads.size(), [&](std::size_t i) { first[(std::ptrdiff_t)loads[i].table]->load_page(loads[i].page); });
+      loaded = loaded || !loads.empty();
+      first = last;
+    }
+
+    if (!loaded) return false;
+    m_version = s_next_version++;
+    return true;
+  }
+
+  // Changes whenever what the model looks like changes and differs between models, so
+  // a renderer can tell whether the model it last drew is still current
+  auto version() const -> std::uint64_t {
+    return m_version;
+  }
+
 private:
-  std::vector<Mesh> m_meshes;
-  std::unordered_map<std::string, Texture> m_textures;
+  std::vector<Mesh> m_meshes{};
+  std::vector<Vertex> m_vertices{}; // storage of parsed meshes
+  std::optional<MappedFile> m_cache{}; // storage of cached meshes
+  texture_lib m_textures{};
+  std::vector<TextureRef> m_texture_refs{};
+
+  inline static std::atomic<std::uint64_t> s_next_version{1};
+  std::uint64_t m_version{s_next_version++};
+
+  // Files are split at line boundaries into chunks that are parsed in parallel
+  // and then stitched in file order, so the result does not depend on the chunk count.
+  // Returns the files the model was built from.
+  auto parse_obj(const std::string& filepath) -> std::vector<CacheSource> {
+    auto file = MappedFile{filepath};
+    auto dir = std::filesystem::path{filepath}.parent_path();
+    auto sources = std::vector{describe_source(dir, std::filesystem::path{filepath}.filename().string())};
+
+    constexpr auto min_chunk_size = std::size_t{1} << 20;
+    auto texts = split_lines(file.view(), worker_count(), min_chunk_size);
+    auto chunks = std::vector<ObjChunk>(texts.size());
+    parallel_for(chunks.size(), [&](std::size_t i) {
+      chunks[i] = parse_obj_chunk(texts[i]);
+    });
+
+    auto positions = gather(chunks, &ObjChunk::positions);
+    auto normals = gather(chunks, &ObjChunk::normals);
+    auto uvs = gather(chunks, &ObjChunk::uvs);
+
+    // Faces of a chunk between two statements go to the same mesh. The statements are
+    // replayed in file order to find that mesh and where the faces land in m_vertices.
+    struct Segment {
+      std::size_t chunk;
+      std::size_t first_face;
+      std::size_t last_face;
+      std::size_t offset; // in m_vertices
+    };
+
+    auto segments = std::vector<Segment>{};
+    auto mesh_ranges = std::vector<std::pair<std::size_t, std::size_t>>{}; // offset and size in m_vertices
+    auto vertex_count = std::size_t{0};
+    auto materials = std::optional<material_lib>{};
+
+    for (auto c = 0u; c < chunks.size(); ++c) {
+      auto face = std::size_t{0};
+      auto vertex = std::size_t{0};
+
+      auto add_segment = [&](std::size_t end_face, std::size_t end_vertex) {
+        if (end_face == face) return;
+        if (m_meshes.empty()) {
+          m_meshes.emplace_back();
+          mesh_ranges.emplace_back(vertex_count, 0);
+        }
+        segments.push_back({c, face, end_face, vertex_count});
+        mesh_ranges.back().second += end_vertex - vertex;
+        vertex_count += end_vertex - vertex;
+        face = end_face;
+        vertex = end_vertex;
+      };
+
+      for (const auto& statement : chunks[c].statements) {
+        add_segment(statement.face, statement.vertex);
+
+        if (statement.kind == ObjStatement::Kind::usemtl && materials) {
+          if (!materials->contains(statement.name))
+            throw std::runtime_error{"material not found: " + statement.name};
+
+          m_meshes.emplace_back();
+          m_meshes.back().material = materials->at(statement.name);
+          mesh_ranges.emplace_back(vertex_count, 0);
+        }
+        else if (statement.kind == ObjStatement::Kind::mtllib) {
+          auto mtl_filepath = (dir / statement.name).string();
+          materials = parse_mtl(mtl_filepath);
+          sources.push_back(describe_source(dir, statement.name));
+
+          auto add_texture = [&](const std::optional<std::string>& name, ColorSpace color_space) {
+            auto same_name = [&](const TextureRef& ref) { return ref.name == *name; };
+            if (name && std::find_if(m_texture_refs.begin(), m_texture_refs.end(), same_name) == m_texture_refs.end())
+              m_texture_refs.push_back({*name, color_space});
+          };
+          for (auto& [_, material] : *materials) {
+            add_texture(material.diffuse_texture, ColorSpace::srgb);
+            add_texture(material.emissive_texture, ColorSpace::srgb);
+            add_texture(material.normal_texture, ColorSpace::linear);
+            add_texture(material.metallic_roughness_texture, ColorSpace::linear);
+          }
+        }
+      }
+
+      add_segment(chunks[c].faces.size(), chunks[c].vertex_count);
+    }
+
+    m_vertices.resize(vertex_count);
+    parallel_for(segments.size(), [&](std::size_t i) {
+      const auto& segment = segments[i];
+      auto* out = m_vertices.data() + segment.offset;
+      for (auto f = segment.first_face; f < segment.last_face; ++f) {
+        const auto& face = chunks[segment.chunk].faces[f];
+        assemble_face(face, positions, normals, uvs, out);
+        out += face.size == 4 ? 6 : 3;
+      }
+    });
+
+    parallel_for(m_meshes.size(), [&](std::size_t i) {
+      auto& mesh = m_meshes[i];
+      auto vertices = std::span{m_vertices}.subspan(mesh_ranges[i].first, mesh_ranges[i].second);
+      compute_tangents(vertices);
+      mesh.vertices = vertices;
+      for (const auto& vertex : mesh.vertices)
+        mesh.bounds.extend(vertex.position);
+    });
+
+    return sources;
+  }
 };
 
-#endif // MODEL_HPP
\ No newline at end of file
+#endif // MODEL_HPP
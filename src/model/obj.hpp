@@ -0,0 +1,184 @@
+#ifndef MODEL_OBJ_HPP
+#define MODEL_OBJ_HPP
+
+#include "math/vector.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Index {
+  std::uint32_t position;
+  std::optional<std::uint32_t> uv;
+  std::optional<std::uint32_t> normal;
+};
+
+struct Face {
+  std::array<Index, 4> indices;
+  std::uint32_t size; // 3 or 4
+};
+
+// Removes and returns the first whitespace separated token of line
+inline auto next_token(std::string_view& line) -> std::string_view {
+  auto begin = line.find_first_not_of(" \t\r");
+  if (begin == std::string_view::npos) {
+    line = {};
+    return {};
+  }
+  auto end = line.find_first_of(" \t\r", begin);
+  if (end == std::string_view::npos) end = line.size();
+  auto token = line.substr(begin, end - begin);
+  line.remove_prefix(end);
+  return token;
+}
+
+inline auto parse_float(std::string_view& line) -> float {
+  auto token = next_token(line);
+  if (token.starts_with('+')) token.remove_prefix(1);
+  auto value = 0.0f;
+  auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+  if (ec != std::errc{} || ptr != token.data() + token.size())
+    throw std::runtime_error{"Invalid number: " + std::string{token}};
+  return value;
+}
+
+// Parses a 1-based OBJ index into a 0-based index
+inline auto parse_index(std::string_view token) -> std::uint32_t {
+  auto value = std::int64_t{};
+  auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+  if (ec != std::errc{} || ptr != token.data() + token.size())
+    throw std::runtime_error{"Invalid index: " + std::string{token}};
+  if (value < 0)
+    throw std::runtime_error{"Negative indices are not supported"};
+  if (value == 0 || value > UINT32_MAX)
+    throw std::runtime_error{"Index out of range: " + std::string{token}};
+  return (std::uint32_t)(value - 1);
+}
+
+/// @param line the face line without prefix "f"
+inline auto parse_face(std::string_view line) -> Face {
+  auto face = Face{};
+  face.size = 0;
+
+  for (auto token = next_token(line); !token.empty(); token = next_token(line)) {
+    if (face.size == 4)
+      throw std::runtime_error{"Only triangular and quadrilateral faces are supported"};
+
+    auto first_slash = token.find('/');
+    auto second_slash = token.find('/', first_slash + 1);
+    auto& index = face.indices[face.size++];
+    index = Index{};
+
+    if (first_slash == std::string_view::npos) {
+      // only position index
+      index.position = parse_index(token);
+    }
+    else if (second_slash == std::string_view::npos) {
+      // position and uv indices
+      index.position = parse_index(token.substr(0, first_slash));
+      index.uv = parse_index(token.substr(first_slash + 1));
+    }
+    else {
+      // position, uv, and normal indices
+      index.position = parse_index(token.substr(0, first_slash));
+      if (second_slash > first_slash + 1)
+        index.uv = parse_index(token.substr(first_slash + 1, second_slash - first_slash - 1));
+      if (second_slash < token.size() - 1)
+        index.normal = parse_index(token.substr(second_slash + 1));
+    }
+  }
+
+  if (face.size < 3)
+    throw std::runtime_error{"Only triangular and quadrilateral faces are supported"};
+
+  return face;
+}
+
+// An `mtllib` or `usemtl` statement and where it appeared relative to the faces of its chunk
+struct ObjStatement {
+  enum class Kind { mtllib, usemtl };
+
+  Kind kind;
+  std::string name;
+  std::size_t face; // faces of the chunk before the statement
+  std::size_t vertex; // mesh vertices emitted by those faces
+};
+
+// Everything declared by a range of lines of an OBJ file. Indices in faces are
+// file-global, so chunks can be parsed independently and stitched in order.
+struct ObjChunk {
+  std::vector<Vec3f> positions{};
+  std::vector<Vec3f> normals{};
+  std::vector<Vec2f> uvs{};
+  std::vector<Face> faces{};
+  std::vector<ObjStatement> statements{};
+  std::size_t vertex_count{0}; // mesh vertices emitted by all faces (3 per triangle, 6 per quad)
+};
+
+// Splits text into at most max_chunks pieces of at least min_chunk_size bytes (except the last one),
+// cutting only at line boundaries
+inline auto split_lines(std::string_view text, std::size_t max_chunks, std::size_t min_chunk_size) -> std::vector<std::string_view> {
+  auto chunk_size = std::max(min_chunk_size, text.size() / std::max<std::size_t>(max_chunks, 1) + 1);
+  auto chunks = std::vector<std::string_view>{};
+
+  while (!text.empty()) {
+    auto end = text.size() <= chunk_size ? std::string_view::npos : text.find('\n', chunk_size);
+    if (end == std::string_view::npos) {
+      chunks.push_back(text);
+      break;
+    }
+    chunks.push_back(text.substr(0, end + 1));
+    text.remove_prefix(end + 1);
+  }
+
+  return chunks;
+}
+
+inline auto parse_obj_chunk(std::string_view text) -> ObjChunk {
+  auto chunk = ObjChunk{};
+
+  while (!text.empty()) {
+    auto end = text.find('\n');
+    auto line = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+
+    auto token = next_token(line);
+    if (token == "v") {
+      auto position = Vec3f{};
+      position.x = parse_float(line);
+      position.y = parse_float(line);
+      position.z = parse_float(line);
+      chunk.positions.push_back(position);
+    }
+    else if (token == "vn") {
+      auto normal = Vec3f{};
+      normal.x = parse_float(line);
+      normal.y = parse_float(line);
+      normal.z = parse_float(line);
+      chunk.normals.push_back(normal);
+    }
+    else if (token == "vt") {
+      auto uv = Vec2f{};
+      uv.x = parse_float(line);
+      uv.y = parse_float(line);
+      chunk.uvs.push_back(uv);
+    }
+    else if (token == "f") {
+      chunk.faces.push_back(parse_face(line));
+      chunk.vertex_count += chunk.faces.back().size == 4 ? 6u : 3u;
+    }
+    else if (token == "usemtl" || token == "mtllib") {
+      auto kind = token == "usemtl" ? ObjStatement::Kind::usemtl : ObjStatement::Kind::mtllib;
+      chunk.statements.push_back({kind, std::string{next_token(line)}, chunk.faces.size(), chunk.vertex_count});
+    }
+  }
+
+  return chunk;
+}
+
+#endif // MODEL_OBJ_HPP
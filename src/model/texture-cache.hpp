@@ -0,0 +1,126 @@
+#ifndef MODEL_TEXTURE_CACHE_HPP
+#define MODEL_TEXTURE_CACHE_HPP
+
+#include "io/binary.hpp"
+#include "io/cache-file.hpp"
+#include "io/mapped-file.hpp"
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Binary texture cache, written next to the source image as "<image>.cache".
+// It holds the texels of every mip level exactly as Texture keeps them in memory,
+// so loading a cached texture is a mapping instead of a decode.
+// Layout (native byte order):
+//   header:    magic "RTEX", u32 version
+//   source:    string path, u64 size, i64 mtime, u64 hash
+//   texture:   u32 variant, u32 width, u32 height, u32 channels, u32 format
+//   levels:    u32 count, then per level: u32 width, u32 height, u64 offset
+//   texels:    u64 size, then aligned to 16 bytes, the texels of all levels
+// The variant identifies the options the texels were produced with (flip, color
+// space, layout, compression); a cache with another variant is rebuilt.
+
+constexpr auto texture_cache_magic = std::array{'R', 'T', 'E', 'X'};
+constexpr auto texture_cache_version = std::uint32_t{1};
+constexpr auto texture_cache_alignment = std::size_t{16};
+
+enum class TextureFormat : std::uint32_t {
+  unorm8, // one byte per channel
+  bc1,
+  bc3
+};
+
+struct TextureLevel {
+  unsigned width;
+  unsigned height;
+  std::size_t offset; // of the first texel or block in the texel data
+};
+
+struct TextureHeader {
+  std::uint32_t variant;
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t channels;
+  TextureFormat format;
+};
+
+// Returns false if the cache could not be written
+inline auto write_texture_cache(const std::string& filepath, const CacheSource& source, const TextureHeader& header, const std::vector<TextureLevel>& levels, std::span<const std::uint8_t> texels) -> bool {
+  auto writer = BinaryWriter{};
+  writer.write(texture_cache_magic);
+  writer.write(texture_cache_version);
+  write_source(writer, source);
+
+  writer.write(header.variant);
+  writer.write(header.width);
+  writer.write(header.height);
+  writer.write(header.channels);
+  writer.write(header.format);
+
+  writer.write((std::uint32_t)levels.size());
+  for (const auto& level : levels) {
+    writer.write((std::uint32_t)level.width);
+    writer.write((std::uint32_t)level.height);
+    writer.write((std::uint64_t)level.offset);
+  }
+
+  writer.write((std::uint64_t)texels.size());
+  writer.align(texture_cache_alignment);
+  writer.write_bytes(texels.data(), texels.size());
+
+  return write_cache_file(filepath, writer.data());
+}
+
+struct TextureCache {
+  MappedFile file;
+  TextureHeader header;
+  std::vector<TextureLevel> levels;
+  std::span<const std::uint8_t> texels; // points into file
+};
+
+// Returns none if there is no cache, it is from another version or variant, its
+// source changed, or it is malformed. Level offsets are not checked against the texels.
+inline auto read_texture_cache(const std::string& filepath, std::uint32_t variant) -> std::optional<TextureCache> {
+  auto error = std::error_code{};
+  if (!std::filesystem::exists(filepath, error)) return {};
+
+  try {
+    auto file = MappedFile{filepath};
+    auto reader = BinaryReader{file.view()};
+
+    if (reader.read<decltype(texture_cache_magic)>() != texture_cache_magic) return {};
+    if (reader.read<std::uint32_t>() != texture_cache_version) return {};
+    if (!is_current(read_source(reader), std::filesystem::path{filepath}.parent_path())) return {};
+
+    auto header = TextureHeader{};
+    header.variant = reader.read<std::uint32_t>();
+    if (header.variant != variant) return {};
+    header.width = reader.read<std::uint32_t>();
+    header.height = reader.read<std::uint32_t>();
+    header.channels = reader.read<std::uint32_t>();
+    header.format = reader.read<TextureFormat>();
+
+    auto levels = std::vector<TextureLevel>(reader.read<std::uint32_t>());
+    for (auto& level : levels) {
+      level.width = reader.read<std::uint32_t>();
+      level.height = reader.read<std::uint32_t>();
+      level.offset = reader.read<std::uint64_t>();
+    }
+
+    auto size = reader.read<std::uint64_t>();
+    reader.align(texture_cache_alignment);
+    auto texels = std::span{(const std::uint8_t*)reader.read_bytes((std::size_t)size), (std::size_t)size};
+
+    return TextureCache{std::move(file), header, std::move(levels), texels};
+  }
+  catch (const std::exception&) {
+    return {};
+  }
+}
+
+#endif // MODEL_TEXTURE_CACHE_HPP
@@ -0,0 +1,284 @@
+#ifndef MODEL_TEXTURE_PAGES_HPP
+#define MODEL_TEXTURE_PAGES_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Page residency of streamed textures. Every mip level is split into square pages of
+// texture_page_size texels. The levels that fit in a single page (the mip tail) are
+// kept by each texture, so a coarser resident level always exists; the other pages
+// take slots of a PagePool, whose budget is shared by all the textures using it.
+//
+// While a frame is rendered, PageTable::use() records which pages the sampler touched
+// (from any thread). Between frames, PagePool::update() turns those records into page
+// loads: missing pages that were touched take free slots or evict the pages least
+// recently used by any of the textures.
+
+constexpr auto texture_page_size = 64u; // texels per side
+constexpr auto texture_page_bytes = std::size_t{texture_page_size} * texture_page_size * 4; // RGBA
+
+class PageTable;
+
+// A page to be filled with its texels
+struct PageLoad {
+  std::size_t table; // index of the page table in the update
+  std::size_t page;
+};
+
+// Slots for the pages of several textures under one budget
+class PagePool {
+public:
+  struct Stats {
+    std::size_t resident{0}; // pages in slots
+    std::size_t missing{0}; // pages touched but not resident in the last frame
+    std::size_t loaded{0}; // pages loaded by the last update
+    std::size_t evicted{0}; // pages evicted by the last update
+  };
+
+  /// @param budget number of slots
+  explicit PagePool(std::size_t budget)
+  : m_texels{std::make_unique_for_overwrite<std::uint8_t[]>(budget * texture_page_bytes)},
+    m_owners(budget),
+    m_free{},
+    m_frame{1},
+    m_stats{}
+  {
+    for (auto slot = budget; slot > 0; --slot)
+      m_free.push_back(slot - 1);
+  }
+
+  PagePool(const PagePool&) = delete;
+  auto operator=(const PagePool&) -> PagePool& = delete;
+
+  auto slot_count() const -> std::size_t {
+    return m_owners.size();
+  }
+
+  // Frame the pages used now are recorded in
+  auto frame() const -> std::uint32_t {
+    return m_frame;
+  }
+
+  auto stats() const -> const Stats& {
+    return m_stats;
+  }
+
+  // Ends the frame: picks up to max_loads missing pages that were used in it, coarsest
+  // levels first, and assigns them slots, evicting the least recently used pages of
+  // the tables. Pages used in the frame are never evicted. Meant to be called once per
+  // frame with every table using the pool, while none of them is sampled.
+  auto update(std::span<PageTable* const> tables, std::size_t max_loads) -> std::vector<PageLoad>;
+
+  // Frees the slots of a table that is being destroyed
+  auto release(std::uint64_t table) -> void;
+
+private:
+  struct Owner {
+    std::uint64_t table{0}; // 0 if the slot is free, table ids start at 1
+    std::size_t page{0};
+  };
+
+  std::unique_ptr<std::uint8_t[]> m_texels; // RGBA texels of a page per slot, uninitialized until loaded
+  std::vector<Owner> m_owners; // per slot
+  std::vector<std::size_t> m_free; // free slots
+  std::uint32_t m_frame;
+  Stats m_stats;
+};
+
+// The pages of a streamed texture and where the resident ones are
+class PageTable {
+public:
+  // Level and first texel of a page
+  struct Location {
+    unsigned level;
+    unsigned x;
+    unsigned y;
+  };
+
+  /// @param width, height of the base level; each level halves them down to 1x1
+  PageTable(unsigned width, unsigned height, PagePool& pool)
+  : m_pool{&pool},
+    m_id{s_next_id++},
+    m_levels{},
+    m_texels{},
+    m_used{},
+    m_tail{}
+  {
+    auto count = std::size_t{0};
+    while (true) {
+      auto pages_x = (width + texture_page_size - 1) / texture_page_size;
+      auto pages_y = (height + texture_page_size - 1) / texture_page_size;
+      m_levels.push_back({pages_x, pages_y, count});
+      count += (std::size_t)pages_x * pages_y;
+      if (width == 1 && height == 1) break;
+      width = std::max(width / 2, 1u);
+      height = std::max(height / 2, 1u);
+    }
+
+    m_texels.assign(count, nullptr);
+    m_used = std::vector<std::atomic<std::uint32_t>>(count);
+  }
+
+  PageTable(const PageTable&) = delete;
+
+  PageTable(PageTable&& other) noexcept
+  : m_pool{std::exchange(other.m_pool, nullptr)},
+    m_id{other.m_id},
+    m_levels{std::move(other.m_levels)},
+    m_texels{std::move(other.m_texels)},
+    m_used{std::move(other.m_used)},
+    m_tail{std::move(other.m_tail)}
+  {}
+
+  auto operator=(const PageTable&) -> PageTable& = delete;
+  auto operator=(PageTable&&) -> PageTable& = delete;
+
+  ~PageTable() {
+    if (m_pool) m_pool->release(m_id);
+  }
+
+  auto page_count() const -> std::size_t {
+    return m_texels.size();
+  }
+
+  auto page(unsigned level, unsigned x, unsigned y) const -> std::size_t {
+    const auto& l = m_levels[level];
+    return l.first + (std::size_t)(y / texture_page_size) * l.pages_x + x / texture_page_size;
+  }
+
+  auto locate(std::size_t page) const -> Location {
+    auto level = 0u;
+    while (level + 1 < m_levels.size() && m_levels[level + 1].first <= page) ++level;
+    auto index = page - m_levels[level].first;
+    auto x = (unsigned)(index % m_levels[level].pages_x) * texture_page_size;
+    auto y = (unsigned)(index / m_levels[level].pages_x) * texture_page_size;
+    return {level, x, y};
+  }
+
+  // Records that the page is needed this frame and returns its RGBA texels, or nullptr
+  // if it is not resident. Safe to call from several threads while no update runs.
+  auto use(std::size_t page) const -> const std::uint8_t* {
+    auto& used = m_used[page];
+    if (used.load(std::memory_order_relaxed) != m_pool->frame())
+      used.store(m_pool->frame(), std::memory_order_relaxed);
+    return m_texels[page];
+  }
+
+  // Where the texels of a page being loaded go
+  auto texels(std::size_t page) -> std::uint8_t* {
+    return m_texels[page];
+  }
+
+  // Makes the pages of the mip tail resident, for the caller to fill
+  auto pin() -> std::vector<PageLoad> {
+    auto loads = std::vector<PageLoad>{};
+    for (const auto& level : m_levels) {
+      if (level.pages_x == 1 && level.pages_y == 1)
+        loads.push_back({0, level.first});
+    }
+    m_tail = std::make_unique_for_overwrite<std::uint8_t[]>(loads.size() * texture_page_bytes);
+    for (auto i = 0u; i < loads.size(); ++i)
+      m_texels[loads[i].page] = &m_tail[i * texture_page_bytes];
+    return loads;
+  }
+
+private:
+  friend class PagePool;
+
+  struct Level {
+    unsigned pages_x;
+    unsigned pages_y;
+    std::size_t first; // index of the level's first page
+  };
+
+  inline static std::atomic<std::uint64_t> s_next_id{1};
+
+  PagePool* m_pool; // nullptr once moved from
+  std::uint64_t m_id; // identifies the table in the slots of the pool
+  std::vector<Level> m_levels;
+  std::vector<std::uint8_t*> m_texels; // per page: its texels, in the pool or the tail, or nullptr
+  mutable std::vector<std::atomic<std::uint32_t>> m_used; // per page: the last frame it was used in
+  std::unique_ptr<std::uint8_t[]> m_tail; // texels of the mip tail, a page per level
+};
+
+inline auto PagePool::update(std::span<PageTable* const> tables, std::size_t max_loads) -> std::vector<PageLoad> {
+  // missing pages that were used, ranked by the number of levels above theirs
+  struct Missing {
+    std::size_t rank;
+    PageLoad load;
+  };
+  auto missing = std::vector<Missing>{};
+  for (auto t = std::size_t{0}; t < tables.size(); ++t) {
+    const auto& table = *tables[t];
+    for (auto page = std::size_t{0}; page < table.page_count(); ++page) {
+      if (!table.m_texels[page] && table.m_used[page].load(std::memory_order_relaxed) == m_frame)
+        missing.push_back({table.m_levels.size() - 1 - table.locate(page).level, {t, page}});
+    }
+  }
+  std::ranges::stable_sort(missing, {}, &Missing::rank);
+
+  // slots of pages of the tables that were not used this frame, least recently used last
+  struct Evictable {
+    std::uint32_t used;
+    std::size_t slot;
+    std::size_t table;
+  };
+  auto evictable = std::vector<Evictable>{};
+  if (missing.size() > m_free.size()) {
+    for (auto slot = std::size_t{0}; slot < m_owners.size(); ++slot) {
+      const auto& owner = m_owners[slot];
+      if (owner.table == 0) continue;
+      auto table = std::ranges::find(tables, owner.table, [](const PageTable* t) { return t->m_id; });
+      if (table == tables.end()) continue;
+      auto used = (*table)->m_used[owner.page].load(std::memory_order_relaxed);
+      if (used != m_frame) evictable.push_back({used, slot, (std::size_t)(table - tables.begin())});
+    }
+    std::ranges::sort(evictable, std::greater{}, &Evictable::used);
+  }
+
+  m_stats.missing = missing.size();
+  m_stats.evicted = 0;
+  auto loads = std::vector<PageLoad>{};
+  for (const auto& [rank, load] : missing) {
+    if (loads.size() == max_loads) break;
+    if (m_free.empty()) {
+      if (evictable.empty()) break;
+      auto victim = evictable.back();
+      evictable.pop_back();
+      tables[victim.table]->m_texels[m_owners[victim.slot].page] = nullptr;
+      m_owners[victim.slot] = {};
+      m_free.push_back(victim.slot);
+      --m_stats.resident;
+      ++m_stats.evicted;
+    }
+
+    auto slot = m_free.back();
+    m_free.pop_back();
+    auto& table = *tables[load.table];
+    m_owners[slot] = {table.m_id, load.page};
+    table.m_texels[load.page] = &m_texels[slot * texture_page_bytes];
+    ++m_stats.resident;
+    loads.push_back(load);
+  }
+
+  m_stats.loaded = loads.size();
+  ++m_frame;
+  return loads;
+}
+
+inline auto PagePool::release(std::uint64_t table) -> void {
+  for (auto slot = std::size_t{0}; slot < m_owners.size(); ++slot) {
+    if (m_owners[slot].table != table) continue;
+    m_owners[slot] = {};
+    m_free.push_back(slot);
+    --m_stats.resident;
+  }
+}
+
+#endif // MODEL_TEXTURE_PAGES_HPP
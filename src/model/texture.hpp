@@ -1,48 +1,670 @@
 #ifndef MODEL_TEXTURE_HPP
 #define MODEL_TEXTURE_HPP
 
+#include "math/simd.hpp"
+#include "math/srgb.hpp"
 #include "math/vector.hpp"
+#include "io/cache-file.hpp"
+#include "io/mapped-file.hpp"
+#include "model/block-compression.hpp"
+#include "model/texture-cache.hpp"
+#include "model/texture-pages.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <stdexcept>
 #include <cmath>
 #include <stb_image.h>
 
+// How the color channels are encoded. Alpha is always linear.
+enum class ColorSpace {
+  srgb, // colors, e.g. diffuse maps
+  linear // data, e.g. normal or roughness maps
+};
+
+// A texture file referenced by a model and how its texels are to be decoded
+struct TextureRef {
+  std::string name{}; // relative to the model directory
+  ColorSpace color_space{ColorSpace::srgb};
+};
+
+// Order of the texels of every mip level in memory
+enum class TextureLayout {
+  linear, // rows of texels
+  tiled // 4x4 texel tiles in rows of tiles, each tile stored row by row (one 64-byte cache line for RGBA)
+};
+
+enum class TextureCompression {
+  none,
+  bc // BC1 for opaque textures, BC3 for textures with alpha
+};
+
+struct TextureOptions {
+  bool vertical_flip{true};
+  ColorSpace color_space{ColorSpace::srgb};
+  TextureLayout layout{TextureLayout::linear}; // of uncompressed textures; blocks are 4x4 tiles already
+  TextureCompression compression{TextureCompression::none};
+  bool use_cache{true}; // load from and save to "<image>.cache"
+  // If not 0, the texture is streamed: at most this many pages of texture_page_size^2
+  // texels are resident in its page pool, which textures decoded together share, and
+  // sampling falls back to coarser levels for missing pages
+  std::size_t page_budget{0};
+};
+
+// How texel coordinates outside the texture are mapped back into it
+enum class WrapMode {
+  repeat,
+  clamp, // to the edge texels
+  mirror // repeat, flipping every other copy
+};
+
+enum class TextureFilter {
+  nearest, // nearest texel of the nearest mip level
+  bilinear, // 2x2 texels of the nearest mip level
+  trilinear // 2x2 texels of the two nearest mip levels
+};
+
+struct Sampler {
+  TextureFilter filter{TextureFilter::trilinear};
+  WrapMode wrap_u{WrapMode::repeat};
+  WrapMode wrap_v{WrapMode::repeat};
+  // Up to this many samples are taken along the longer axis of the pixel footprint,
+  // each at the level of detail of the footprint's shorter axis. 1 disables it.
+  unsigned max_anisotropy{1};
+};
+
+// Texels are kept as 8-bit channels, as many as the image has (R, RG, RGB or RGBA),
+// and converted to normalized floats when sampled; the color channels of sRGB textures
+// are decoded to linear then, so filtering and shading work on linear values.
+// A full mip chain is built at load with a 2x2 box filter; sRGB colors are averaged in linear space.
+// With the tiled layout, texels that are close vertically are also close in memory, which
+// keeps the cache warm when the sampled footprint moves across rows (e.g. rotated surfaces).
+// Compressed textures keep every level as BC blocks; sampling decodes whole blocks into a
+// small per-thread cache, so neighbouring samples rarely decode the same block twice.
+// The texels of a cached texture are used in place from the mapped cache file.
+// A streamed texture keeps only the pages it samples in a page pool, filled on demand
+// from the mapped cache file (or the decoded image if the cache cannot be written).
+// Without a cache, only the size of its image is read until it is first streamed.
 class Texture {
 public:
-  explicit Texture(const std::string& filepath, bool vertical_flip = true) {
-    stbi_set_flip_vertically_on_load(vertical_flip);
+  /// @param page_pool holds the pages of a streamed texture, shared with other textures;
+  /// without one, a streamed texture gets a pool of options.page_budget pages of its own
+  explicit Texture(const std::string& filepath, const TextureOptions& options = {}, std::shared_ptr<PagePool> page_pool = {})
+  : m_id{s_next_id++},
+    m_width{0},
+    m_height{0},
+    m_channels{0},
+    m_layout{options.layout},
+    m_color_space{options.color_space},
+    m_format{TextureFormat::unorm8},
+    m_levels{},
+    m_data{},
+    m_cache{},
+    m_texels{},
+    m_pending{},
+    m_page_pool{},
+    m_page_table{}
+  {
+    auto cache = options.use_cache ? read_texture_cache(filepath + ".cache", cache_variant(options)) : std::nullopt;
+    if (cache && load_cache(*cache)) {
+      m_cache = std::move(cache->file);
+    }
+    else if (options.page_budget > 0) {
+      read_size(filepath);
+      m_pending = Source{filepath, options};
+    }
+    else {
+      build(filepath, options);
+    }
+
+    if (options.page_budget > 0) {
+      m_page_pool = page_pool ? std::move(page_pool) : std::make_shared<PagePool>(options.page_budget);
+      m_page_table.emplace((unsigned)m_width, (unsigned)m_height, *m_page_pool);
+      if (!m_pending) load_pages(m_page_table->pin());
+    }
+  }
+
+  // nearest sampling of the base level with repeat wrapping
+  auto operator[](Vec2f uv) const -> Vec4f {
+    return nearest(m_levels[0], uv, Sampler{}).to_vec4();
+  }
+
+  // Level of detail for a pixel whose uv changes by duv_dx and duv_dy to the
+  // neighbouring pixels on the right and below
+  auto lod(Vec2f duv_dx, Vec2f duv_dy) const -> float {
+    auto size = Vec2f{(float)m_width, (float)m_height};
+    auto rho2 = std::max(dot(duv_dx * size, duv_dx * size), dot(duv_dy * size, duv_dy * size));
+    return 0.5f * std::log2(std::max(rho2, 1e-12f));
+  }
+
+  // Samples at an explicit level of detail. Anisotropy is ignored.
+  auto sample(Vec2f uv, float lod, const Sampler& sampler = {}) const -> Vec4f {
+    return filter(uv, lod, sampler).to_vec4();
+  }
+
+  // Samples a pixel whose uv changes by duv_dx and duv_dy to the neighbouring
+  // pixels on the right and below
+  auto sample(Vec2f uv, Vec2f duv_dx, Vec2f duv_dy, const Sampler& sampler = {}) const -> Vec4f {
+    return footprint(uv, duv_dx, duv_dy, sampler).to_vec4();
+  }
+
+  // Samples a 2x2 pixel quad (top left, top right, bottom left, bottom right) in one call,
+  // with the uv derivatives taken from the differences between the quad's uvs
+  auto sample_quad(const std::array<Vec2f, 4>& uv, const Sampler& sampler = {}) const -> std::array<Vec4f, 4> {
+    auto duv_dx = uv[1] - uv[0];
+    auto duv_dy = uv[2] - uv[0];
+    return {
+      footprint(uv[0], duv_dx, duv_dy, sampler).to_vec4(),
+      footprint(uv[1], duv_dx, duv_dy, sampler).to_vec4(),
+      footprint(uv[2], duv_dx, duv_dy, sampler).to_vec4(),
+      footprint(uv[3], duv_dx, duv_dy, sampler).to_vec4()
+    };
+  }
+
+  auto width() const -> int {
+    return m_width;
+  }
+
+  auto height() const -> int {
+    return m_height;
+  }
+
+  auto channels() const -> unsigned {
+    return m_channels;
+  }
+
+  auto level_count() const -> unsigned {
+    return (unsigned)m_levels.size();
+  }
+
+  auto layout() const -> TextureLayout {
+    return m_layout;
+  }
+
+  auto compressed() const -> bool {
+    return m_format != TextureFormat::unorm8;
+  }
+
+  // size of the texel data of all levels in bytes
+  auto size_bytes() const -> std::size_t {
+    return m_texels.size();
+  }
+
+  // whether the texels were loaded from the texture cache
+  auto cached() const -> bool {
+    return m_cache.has_value();
+  }
+
+  // Page residency of a streamed texture, nullptr if every level is resident
+  auto page_table() const -> const PageTable* {
+    return m_page_table ? &*m_page_table : nullptr;
+  }
+
+  auto page_table() -> PageTable* {
+    return m_page_table ? &*m_page_table : nullptr;
+  }
+
+  // Of a streamed texture, nullptr if every level is resident
+  auto page_pool() const -> PagePool* {
+    return m_page_pool.get();
+  }
+
+  // Whether there are texels to sample. A streamed texture without a cache has none
+  // until prepare() builds them, and must not be sampled before.
+  auto ready() const -> bool {
+    return !m_pending;
+  }
+
+  // Builds the texels of a streamed texture whose cache was missing: the image is
+  // decoded and written to the cache once, and the mip tail made resident. Must not run
+  // concurrently with sampling. Returns whether the texture became ready.
+  auto prepare() -> bool {
+    if (!m_pending) return false;
+    build(m_pending->filepath, m_pending->options);
+    m_pending.reset();
+    load_pages(m_page_table->pin());
+    return true;
+  }
+
+  // Fills a page of a streamed texture that PagePool::update assigned a slot
+  auto load_page(std::size_t page) -> void {
+    auto location = m_page_table->locate(page);
+    const auto& level = m_levels[location.level];
+    auto* texels = m_page_table->texels(page);
+    for (auto y = 0u; y < texture_page_size && location.y + y < level.height; ++y) {
+      for (auto x = 0u; x < texture_page_size && location.x + x < level.width; ++x) {
+        auto rgba = stored_rgba(level, location.x + x, location.y + y);
+        std::copy(rgba.begin(), rgba.end(), &texels[(y * texture_page_size + x) * 4]);
+      }
+    }
+  }
+
+  // Prepares the texture and loads up to max_loads of the pages that were missing when
+  // sampling since the last call, evicting its least recently used pages. For a texture
+  // with a page pool of its own; textures sharing one are streamed together by
+  // Model::stream_textures. Must not run concurrently with sampling; meant for frame
+  // boundaries. Returns whether anything was loaded.
+  auto stream(std::size_t max_loads) -> bool {
+    if (!m_page_table) return false;
+    auto prepared = prepare();
+    auto* table = &*m_page_table;
+    auto loads = m_page_pool->update(std::span{&table, 1}, max_loads);
+    load_pages(loads);
+    return prepared || !loads.empty();
+  }
+
+private:
+  using MipLevel = TextureLevel;
+
+  // The image of a texture and the options to build its texels with
+  struct Source {
+    std::string filepath;
+    TextureOptions options;
+  };
+
+  inline static std::atomic<std::uint64_t> s_next_id{1};
+
+  std::uint64_t m_id; // identifies the texture in the per-thread block caches
+  int m_width;
+  int m_height;
+  unsigned m_channels; // 1 (grey), 2 (grey, alpha), 3 (RGB) or 4 (RGBA) before compression
+  TextureLayout m_layout;
+  ColorSpace m_color_space; // of the stored texels; sampled colors are linear
+  TextureFormat m_format;
+  std::vector<MipLevel> m_levels; // level 0 is the full resolution image
+  std::vector<std::uint8_t> m_data; // empty if the texels are mapped from the cache
+  std::optional<MappedFile> m_cache;
+  std::span<const std::uint8_t> m_texels; // m_data or the texels in m_cache
+  std::optional<Source> m_pending; // of a streamed texture that is not ready
+  std::shared_ptr<PagePool> m_page_pool; // only for streamed textures
+  std::optional<PageTable> m_page_table; // only for streamed textures, released before the pool
+
+  static constexpr auto tile_size = 4u;
+
+  // Texels in a level, including the padding of partial tiles
+  auto texel_count(unsigned width, unsigned height) const -> std::size_t {
+    if (m_layout == TextureLayout::linear)
+      return (std::size_t)width * height;
+    auto round_up = [](unsigned size) { return (size + tile_size - 1) / tile_size * tile_size; };
+    return (std::size_t)round_up(width) * round_up(height);
+  }
+
+  auto texel_index(const MipLevel& level, unsigned x, unsigned y) const -> std::size_t {
+    if (m_layout == TextureLayout::linear)
+      return (std::size_t)y * level.width + x;
+    auto tiles_per_row = (level.width + tile_size - 1) / tile_size;
+    auto tile = (std::size_t)(y / tile_size) * tiles_per_row + x / tile_size;
+    return tile * tile_size * tile_size + (y % tile_size) * tile_size + x % tile_size;
+  }
+
+  auto texel_data(const MipLevel& level, unsigned x, unsigned y) const -> const std::uint8_t* {
+    return &m_texels[level.offset + texel_index(level, x, y) * m_channels];
+  }
+
+  // only while the texels are being built in m_data
+  auto texel_data(const MipLevel& level, unsigned x, unsigned y) -> std::uint8_t* {
+    return &m_data[level.offset + texel_index(level, x, y) * m_channels];
+  }
+
+  // RGBA normalized to [0, 1], with linear colors. Grey is replicated to RGB and
+  // missing alpha is 1. A streamed texture returns the texel of the finest resident
+  // level instead.
+  auto texel(const MipLevel& level, unsigned x, unsigned y) const -> Float4 {
+    if (!m_page_table)
+      return to_linear(stored_rgba(level, x, y).data());
+
+    for (auto l = (unsigned)(&level - m_levels.data()); ; ++l) {
+      if (const auto* page = m_page_table->use(m_page_table->page(l, x, y))) {
+        auto index = ((y % texture_page_size) * texture_page_size + x % texture_page_size) * 4;
+        return to_linear(page + index);
+      }
+      // the mip tail is resident, so this ends at the last level at the latest
+      x = std::min(x / 2, m_levels[l + 1].width - 1);
+      y = std::min(y / 2, m_levels[l + 1].height - 1);
+    }
+  }
+
+  // RGBA texel as stored (sRGB encoded for sRGB textures), ignoring page residency
+  auto stored_rgba(const MipLevel& level, unsigned x, unsigned y) const -> std::array<std::uint8_t, 4> {
+    if (m_format != TextureFormat::unorm8) {
+      const auto* p = &decoded_block(level, x / 4, y / 4)[((y % 4) * 4 + x % 4) * 4];
+      return {p[0], p[1], p[2], p[3]};
+    }
+
+    const auto* p = texel_data(level, x, y);
+    switch (m_channels) {
+      case 1: return {p[0], p[0], p[0], 255};
+      case 2: return {p[0], p[0], p[0], p[1]};
+      case 3: return {p[0], p[1], p[2], 255};
+      default: return {p[0], p[1], p[2], p[3]};
+    }
+  }
+
+  // Normalized RGBA of stored bytes, with the colors of sRGB textures decoded
+  auto to_linear(const std::uint8_t* rgba) const -> Float4 {
+    if (m_color_space == ColorSpace::linear)
+      return Float4::from_unorm8(rgba);
+    return Float4{srgb_decode_table[rgba[0]], srgb_decode_table[rgba[1]], srgb_decode_table[rgba[2]], (float)rgba[3] / 255.0f};
+  }
+
+  // Identifies the options that change the texels, so a cache built with other options is not used
+  static auto cache_variant(const TextureOptions& options) -> std::uint32_t {
+    return (std::uint32_t)options.vertical_flip
+      | (std::uint32_t)options.color_space << 1
+      | (std::uint32_t)options.layout << 2
+      | (std::uint32_t)options.compression << 3;
+  }
+
+  // Size of the texel data of a level in bytes
+  auto level_size(const MipLevel& level) const -> std::size_t {
+    if (m_format == TextureFormat::unorm8)
+      return texel_count(level.width, level.height) * m_channels;
+    return (std::size_t)((level.width + 3) / 4) * ((level.height + 3) / 4) * block_size();
+  }
+
+  // Takes the texels from the cache if its levels are consistent with them
+  auto load_cache(const TextureCache& cache) -> bool {
+    const auto& header = cache.header;
+    if (header.width == 0 || header.height == 0 || header.channels == 0 || header.channels > 4) return false;
+    if (header.format != TextureFormat::unorm8 && header.format != TextureFormat::bc1 && header.format != TextureFormat::bc3) return false;
+    if (cache.levels.empty() || cache.levels[0].width != header.width || cache.levels[0].height != header.height) return false;
+
+    m_width = (int)header.width;
+    m_height = (int)header.height;
+    m_channels = header.channels;
+    m_format = header.format;
+    for (const auto& level : cache.levels) {
+      if (level.width == 0 || level.height == 0) return false;
+      if (level.offset > cache.texels.size() || level_size(level) > cache.texels.size() - level.offset) return false;
+    }
+
+    m_levels = cache.levels;
+    m_texels = cache.texels;
+    return true;
+  }
+
+  auto load_pages(const std::vector<PageLoad>& loads) -> void {
+    for (const auto& load : loads)
+      load_page(load.page);
+  }
+
+  // Decodes the image and writes the cache. A streamed texture is then backed by the
+  // mapped cache rather than the decoded image.
+  auto build(const std::string& filepath, const TextureOptions& options) -> void {
+    decode(filepath, options);
+    m_texels = m_data;
+    if (!options.use_cache) return;
+
+    auto cache_filepath = filepath + ".cache";
+    auto path = std::filesystem::path{filepath};
+    auto header = TextureHeader{cache_variant(options), (std::uint32_t)m_width, (std::uint32_t)m_height, m_channels, m_format};
+    auto written = write_texture_cache(cache_filepath, describe_source(path.parent_path(), path.filename().string()), header, m_levels, m_texels);
+    if (!written || options.page_budget == 0) return;
+
+    auto cache = read_texture_cache(cache_filepath, cache_variant(options));
+    if (cache && load_cache(*cache)) {
+      m_cache = std::move(cache->file);
+      m_data = {};
+    }
+    else {
+      m_texels = m_data;
+    }
+  }
+
+  // Size and channels of the image, without decoding it
+  auto read_size(const std::string& filepath) -> void {
+    auto channels = 0;
+    if (!stbi_info(filepath.c_str(), &m_width, &m_height, &channels))
+      throw std::runtime_error{"Failed to load texture: " + filepath};
+    m_channels = (unsigned)channels;
+  }
+
+  auto decode(const std::string& filepath, const TextureOptions& options) -> void {
+    m_format = TextureFormat::unorm8; // a rejected cache may have left another format
+    stbi_set_flip_vertically_on_load_thread(options.vertical_flip); // textures may be decoded concurrently
     auto channels = 0;
     auto* data = stbi_load(filepath.c_str(), &m_width, &m_height, &channels, 0);
     if (!data)
       throw std::runtime_error{"Failed to load texture: " + filepath};
 
-    m_data.reserve((unsigned)(m_width * m_height));
-    for (auto i = 0u; i < (unsigned)(m_width * m_height); ++i) {
-      auto ch = (unsigned)channels;
-      auto r = data[i * ch + 0] / 255.0f;
-      auto g = data[i * ch + 1] / 255.0f;
-      auto b = data[i * ch + 2] / 255.0f;
-      auto a = ch >= 4 ? data[i * ch + 3] / 255.0f : 1.0f;
-      m_data.emplace_back(r, g, b, a);
+    m_channels = (unsigned)channels;
+    allocate_levels();
+    for (auto y = 0u; y < (unsigned)m_height; ++y) {
+      for (auto x = 0u; x < (unsigned)m_width; ++x) {
+        const auto* texel = data + (y * (unsigned)m_width + x) * m_channels;
+        std::copy(texel, texel + m_channels, texel_data(m_levels[0], x, y));
+      }
     }
-    
     stbi_image_free(data);
+
+    build_mipmaps(options.color_space);
+    if (options.compression == TextureCompression::bc)
+      compress();
   }
 
-  // nearest sampling with repeat wrapping
-  auto operator[](Vec2f uv) const -> const Vec4f& {
-    uv.x -= std::floor(uv.x); // range is now [0, 1)
-    uv.y -= std::floor(uv.y);
-    auto x = (unsigned)(uv.x * m_width);
-    auto y = (unsigned)(uv.y * m_height);
-    return m_data[y * (unsigned)m_width + x];
+  auto block_size() const -> std::size_t {
+    return m_format == TextureFormat::bc1 ? bc1_block_size : bc3_block_size;
   }
 
-private:
-  int m_width;
-  int m_height;
-  std::vector<Vec4f> m_data; // RGBA normalized to [0, 1]
+  auto decoded_block(const MipLevel& level, unsigned block_x, unsigned block_y) const -> const RgbaBlock& {
+    struct Entry {
+      std::uint64_t texture; // 0 for an empty entry, ids start at 1
+      std::size_t offset;
+      RgbaBlock texels;
+    };
+    thread_local auto cache = std::array<Entry, 256>{};
+
+    auto blocks_per_row = (level.width + 3) / 4;
+    auto offset = level.offset + ((std::size_t)block_y * blocks_per_row + block_x) * block_size();
+    auto& entry = cache[(offset / block_size() + m_id * 0x9e3779b97f4a7c15ull) % cache.size()];
+    if (entry.texture != m_id || entry.offset != offset) {
+      if (m_format == TextureFormat::bc1)
+        decode_bc1_block(&m_texels[offset], entry.texels);
+      else
+        decode_bc3_block(&m_texels[offset], entry.texels);
+      entry.texture = m_id;
+      entry.offset = offset;
+    }
+    return entry.texels;
+  }
+
+  // Replaces the texels of every level with BC blocks
+  auto compress() -> void {
+    auto has_alpha = m_channels == 2 || m_channels == 4;
+    auto format = has_alpha ? TextureFormat::bc3 : TextureFormat::bc1;
+    auto size = has_alpha ? bc3_block_size : bc1_block_size;
+
+    auto levels = m_levels;
+    auto data = std::vector<std::uint8_t>{};
+    for (auto l = 0u; l < levels.size(); ++l) {
+      const auto& source = m_levels[l];
+      auto& level = levels[l];
+      level.offset = data.size();
+      auto blocks_x = (level.width + 3) / 4;
+      auto blocks_y = (level.height + 3) / 4;
+      data.resize(data.size() + (std::size_t)blocks_x * blocks_y * size);
+
+      for (auto by = 0u; by < blocks_y; ++by) {
+        for (auto bx = 0u; bx < blocks_x; ++bx) {
+          // edge blocks repeat the last row and column
+          auto block = RgbaBlock{};
+          for (auto i = 0u; i < 16; ++i) {
+            auto x = std::min(bx * 4 + i % 4, level.width - 1);
+            auto y = std::min(by * 4 + i / 4, level.height - 1);
+            const auto* p = texel_data(source, x, y);
+            switch (m_channels) {
+              case 1: block[i * 4 + 0] = block[i * 4 + 1] = block[i * 4 + 2] = p[0]; block[i * 4 + 3] = 255; break;
+              case 2: block[i * 4 + 0] = block[i * 4 + 1] = block[i * 4 + 2] = p[0]; block[i * 4 + 3] = p[1]; break;
+              case 3: std::copy(p, p + 3, &block[i * 4]); block[i * 4 + 3] = 255; break;
+              default: std::copy(p, p + 4, &block[i * 4]); break;
+            }
+          }
+
+          auto* out = &data[level.offset + ((std::size_t)by * blocks_x + bx) * size];
+          if (has_alpha)
+            encode_bc3_block(block, out);
+          else
+            encode_bc1_block(block, out);
+        }
+      }
+    }
+
+    m_levels = std::move(levels);
+    m_data = std::move(data);
+    m_format = format;
+  }
+
+  static auto wrap(long long coord, unsigned size, WrapMode mode) -> unsigned {
+    auto n = (long long)size;
+    switch (mode) {
+      case WrapMode::repeat: {
+        auto i = coord % n;
+        return (unsigned)(i < 0 ? i + n : i);
+      }
+      case WrapMode::clamp:
+        return (unsigned)std::clamp(coord, 0ll, n - 1);
+      case WrapMode::mirror: {
+        auto i = coord % (2 * n);
+        if (i < 0) i += 2 * n;
+        return (unsigned)(i < n ? i : 2 * n - 1 - i);
+      }
+    }
+    return 0;
+  }
+
+  auto nearest(const MipLevel& level, Vec2f uv, const Sampler& sampler) const -> Float4 {
+    auto x = wrap((long long)std::floor(uv.x * (float)level.width), level.width, sampler.wrap_u);
+    auto y = wrap((long long)std::floor(uv.y * (float)level.height), level.height, sampler.wrap_v);
+    return texel(level, x, y);
+  }
+
+  // The four texels are fetched and blended as one vector each
+  auto bilinear(const MipLevel& level, Vec2f uv, const Sampler& sampler) const -> Float4 {
+    // texel centers are at half-integer coordinates
+    auto x = uv.x * (float)level.width - 0.5f;
+    auto y = uv.y * (float)level.height - 0.5f;
+    auto fx = std::floor(x);
+    auto fy = std::floor(y);
+    auto tx = Float4{x - fx};
+    auto ty = Float4{y - fy};
+
+    auto x0 = wrap((long long)fx, level.width, sampler.wrap_u);
+    auto x1 = wrap((long long)fx + 1, level.width, sampler.wrap_u);
+    auto y0 = wrap((long long)fy, level.height, sampler.wrap_v);
+    auto y1 = wrap((long long)fy + 1, level.height, sampler.wrap_v);
+
+    auto top = lerp(texel(level, x0, y0), texel(level, x1, y0), tx);
+    auto bottom = lerp(texel(level, x0, y1), texel(level, x1, y1), tx);
+    return lerp(top, bottom, ty);
+  }
+
+  auto filter(Vec2f uv, float lod, const Sampler& sampler) const -> Float4 {
+    lod = std::clamp(lod, 0.0f, (float)(m_levels.size() - 1));
+    if (sampler.filter == TextureFilter::nearest)
+      return nearest(m_levels[(unsigned)std::lround(lod)], uv, sampler);
+    if (sampler.filter == TextureFilter::bilinear)
+      return bilinear(m_levels[(unsigned)std::lround(lod)], uv, sampler);
+
+    auto level = (unsigned)lod;
+    auto t = lod - (float)level;
+    auto color = bilinear(m_levels[level], uv, sampler);
+    if (t > 0.0f)
+      color = lerp(color, bilinear(m_levels[level + 1], uv, sampler), Float4{t});
+    return color;
+  }
+
+  auto footprint(Vec2f uv, Vec2f duv_dx, Vec2f duv_dy, const Sampler& sampler) const -> Float4 {
+    if (sampler.max_anisotropy <= 1)
+      return filter(uv, lod(duv_dx, duv_dy), sampler);
+
+    auto size = Vec2f{(float)m_width, (float)m_height};
+    auto length_x = length(duv_dx * size);
+    auto length_y = length(duv_dy * size);
+    auto major = std::max(length_x, length_y);
+    auto minor = std::max(std::min(length_x, length_y), 1e-6f);
+    auto count = std::min((unsigned)std::ceil(major / minor), sampler.max_anisotropy);
+    if (count <= 1)
+      return filter(uv, lod(duv_dx, duv_dy), sampler);
+
+    // samples spread evenly along the major axis of the footprint
+    auto axis = length_x > length_y ? duv_dx : duv_dy;
+    auto level = std::log2(std::max(major / (float)count, 1e-6f));
+    auto color = Float4{0.0f};
+    for (auto i = 0u; i < count; ++i) {
+      auto offset = ((float)i + 0.5f) / (float)count - 0.5f;
+      color += filter(uv + axis * offset, level, sampler);
+    }
+    return color * (1.0f / (float)count);
+  }
+
+  // Lays out every level of the mip chain in m_data
+  auto allocate_levels() -> void {
+    m_levels.push_back({(unsigned)m_width, (unsigned)m_height, 0});
+    while (m_levels.back().width > 1 || m_levels.back().height > 1) {
+      const auto& last = m_levels.back();
+      auto offset = last.offset + texel_count(last.width, last.height) * m_channels;
+      m_levels.push_back({std::max(last.width / 2, 1u), std::max(last.height / 2, 1u), offset});
+    }
+
+    const auto& last = m_levels.back();
+    m_data.resize(last.offset + texel_count(last.width, last.height) * m_channels);
+  }
+
+  auto build_mipmaps(ColorSpace color_space) -> void {
+    // Only color channels of sRGB textures are decoded before averaging;
+    // a grey and alpha texture has color in its first channel only
+    auto color_channels = m_channels == 2 ? 1u : std::min(m_channels, 3u);
+    auto srgb = color_space == ColorSpace::srgb;
+
+    auto to_linear = srgb_decode_table;
+    if (!srgb) {
+      for (auto i = 0u; i < 256; ++i)
+        to_linear[i] = (float)i / 255.0f;
+    }
+
+    // linear values quantized to 12 bits, so encoding is a lookup
+    constexpr auto encode_steps = srgb_encode_steps;
+    auto to_byte = srgb_encode_table;
+    if (!srgb) {
+      for (auto i = 0u; i < encode_steps; ++i)
+        to_byte[i] = (std::uint8_t)std::lround((float)i / (float)(encode_steps - 1) * 255.0f);
+    }
+
+    for (auto l = 1u; l < m_levels.size(); ++l) {
+      const auto& src = m_levels[l - 1];
+      const auto& dst = m_levels[l];
+      for (auto y = 0u; y < dst.height; ++y) {
+        auto y0 = std::min(y * 2, src.height - 1);
+        auto y1 = std::min(y * 2 + 1, src.height - 1);
+        for (auto x = 0u; x < dst.width; ++x) {
+          auto x0 = std::min(x * 2, src.width - 1);
+          auto x1 = std::min(x * 2 + 1, src.width - 1);
+          const auto* a = texel_data(src, x0, y0);
+          const auto* b = texel_data(src, x1, y0);
+          const auto* c = texel_data(src, x0, y1);
+          const auto* d = texel_data(src, x1, y1);
+          auto* out = texel_data(dst, x, y);
+
+          for (auto ch = 0u; ch < m_channels; ++ch) {
+            if (ch < color_channels) {
+              auto sum = to_linear[a[ch]] + to_linear[b[ch]] + to_linear[c[ch]] + to_linear[d[ch]];
+              out[ch] = to_byte[(unsigned)std::lround(sum * 0.25f * (float)(encode_steps - 1))];
+            }
+            else {
+              out[ch] = (std::uint8_t)((a[ch] + b[ch] + c[ch] + d[ch] + 2) / 4);
+            }
+          }
+        }
+      }
+    }
+  }
 };
 
-#endif // MODEL_TEXTURE_HPP
\ No newline at end of file
+#endif // MODEL_TEXTURE_HPP
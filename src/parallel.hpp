@@ -0,0 +1,60 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of hardware threads, at least 1
+inline auto worker_count() -> unsigned {
+  auto count = std::thread::hardware_concurrency();
+  return count == 0 ? 1u : count;
+}
+
+// Calls fn(i) for every i in [0, count), spreading the calls across worker threads.
+// The calling thread takes part in the work. If any call throws, the remaining
+// indices are skipped and the first exception is rethrown on the calling thread.
+template<typename Fn>
+inline auto parallel_for(std::size_t count, Fn&& fn) -> void {
+  auto thread_count = std::min<std::size_t>(count, worker_count());
+  if (thread_count <= 1) {
+    for (auto i = std::size_t{0}; i < count; ++i) fn(i);
+    return;
+  }
+
+  auto next = std::atomic<std::size_t>{0};
+  auto failed = std::atomic<bool>{false};
+  auto error = std::exception_ptr{};
+  auto error_mutex = std::mutex{};
+
+  auto work = [&] {
+    while (!failed.load(std::memory_order_relaxed)) {
+      auto i = next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= count) break;
+      try {
+        fn(i);
+      }
+      catch (...) {
+        auto lock = std::scoped_lock{error_mutex};
+        if (!error) error = std::current_exception();
+        failed = true;
+      }
+    }
+  };
+
+  {
+    auto threads = std::vector<std::jthread>{};
+    threads.reserve(thread_count - 1);
+    for (auto i = std::size_t{1}; i < thread_count; ++i)
+      threads.emplace_back(work);
+    work();
+  } // joins the workers
+
+  if (error) std::rethrow_exception(error);
+}
+
+#endif // PARALLEL_HPP
@@ -0,0 +1,48 @@
+#ifndef RENDER_GBUFFER_HPP
+#define RENDER_GBUFFER_HPP
+
+#include "math/vector.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Per-pixel surface data written by the geometry pass of deferred shading
+
+// Marks pixels no triangle was drawn to
+constexpr auto no_material = ~std::uint32_t{0};
+
+struct GBufferTexel {
+  std::uint32_t normal{}; // octahedral encoded, see encode_octahedral
+  std::uint32_t material{no_material}; // index of the mesh in Model::meshes()
+  Vec2f uv{};
+};
+
+// Maps a unit vector to the octahedron |x| + |y| + |z| = 1, folds the lower half over
+// the upper one and stores x and y as 16-bit signed normalized values
+inline auto encode_octahedral(const Vec3f& n) -> std::uint32_t {
+  auto sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  if (sum == 0.0f) return 0;
+  auto x = n.x / sum;
+  auto y = n.y / sum;
+  if (n.z < 0.0f) {
+    auto fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    auto fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = fx;
+    y = fy;
+  }
+  auto snorm = [](float v) { return (std::uint32_t)(std::uint16_t)(std::int16_t)std::lround(std::clamp(v, -1.0f, 1.0f) * 32767.0f); };
+  return snorm(x) | snorm(y) << 16;
+}
+
+// Unit vector of an encoded normal
+inline auto decode_octahedral(std::uint32_t encoded) -> Vec3f {
+  auto x = (float)(std::int16_t)(std::uint16_t)(encoded & 0xffffu) / 32767.0f;
+  auto y = (float)(std::int16_t)(std::uint16_t)(encoded >> 16) / 32767.0f;
+  auto n = Vec3f{x, y, 1.0f - std::abs(x) - std::abs(y)};
+  auto fold = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -fold : fold;
+  n.y += n.y >= 0.0f ? -fold : fold;
+  return normalize(n);
+}
+
+#endif // RENDER_GBUFFER_HPP
@@ -0,0 +1,69 @@
+#ifndef RENDER_LIGHTING_HPP
+#define RENDER_LIGHTING_HPP
+
+#include "math/simd.hpp"
+#include "math/vector.hpp"
+#include "model/mesh.hpp"
+#include <vector>
+
+enum class LightType {
+  directional,
+  point
+};
+
+struct Light {
+  LightType type{LightType::directional};
+  Vec3f direction{0.0f, -1.0f, 0.0f}; // the light travels along it; directional lights only
+  Vec3f position{}; // point lights only
+  Vec3f color{1.0f};
+  float range{10.0f}; // distance at which a point light is at half intensity
+};
+
+// Schlick's approximation of x^n for x in [0, 1]: x / (n - n x + x).
+// Much cheaper than pow and close enough for specular highlights.
+inline auto fast_pow(Float4 x, Float4 n) -> Float4 {
+  return x / (n - n * x + x);
+}
+
+// Blinn-Phong lighting of four pixels at once. Normals need not be normalized and
+// are flipped towards the eye, so back faces are lit like front faces.
+/// @param diffuse_color the material's diffuse color at each pixel, e.g. modulated by a texture
+/// @param ambient the ambient light color
+inline auto blinn_phong(const Material& material, const Vec3x4& diffuse_color, const std::vector<Light>& lights, const Vec3f& ambient, const Vec3f& eye, const Vec3x4& position, const Vec3x4& normal) -> Vec3x4 {
+  auto zero = Float4{0.0f};
+  auto to_eye = normalize(Vec3x4{eye} - position);
+  auto n = normalize(normal);
+  n = select(dot(n, to_eye) < zero, n * Float4{-1.0f}, n);
+
+  auto diffuse = Vec3x4{};
+  auto specular = Vec3x4{};
+  auto shininess = Float4{material.shininess};
+  for (const auto& light : lights) {
+    auto to_light = Vec3x4{};
+    auto attenuation = Float4{1.0f};
+    if (light.type == LightType::directional) {
+      to_light = Vec3x4{light.direction * -1.0f};
+      to_light = normalize(to_light);
+    }
+    else {
+      to_light = Vec3x4{light.position} - position;
+      auto distance2 = dot(to_light, to_light);
+      attenuation = Float4{1.0f} / (Float4{1.0f} + distance2 * Float4{1.0f / (light.range * light.range)});
+      to_light = normalize(to_light);
+    }
+
+    auto n_dot_l = max(dot(n, to_light), zero);
+    auto half = normalize(to_light + to_eye);
+    auto n_dot_h = max(dot(n, half), zero);
+    // no highlight on the side facing away from the light
+    auto highlight = select(n_dot_l > zero, fast_pow(n_dot_h, shininess), zero);
+
+    auto radiance = Vec3x4{light.color} * attenuation;
+    diffuse += radiance * n_dot_l;
+    specular += radiance * highlight;
+  }
+
+  return Vec3x4{material.ambient * ambient} + diffuse_color * diffuse + Vec3x4{material.specular} * specular;
+}
+
+#endif // RENDER_LIGHTING_HPP
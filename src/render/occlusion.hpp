@@ -0,0 +1,156 @@
+#ifndef RENDER_OCCLUSION_HPP
+#define RENDER_OCCLUSION_HPP
+
+#include "math/matrix.hpp"
+#include "math/simd.hpp"
+#include "math/vector.hpp"
+#include "model/mesh.hpp"
+#include "render/raster.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <vector>
+
+// How a box relates to the view and the occluders
+enum class BoxVisibility {
+  visible, // may be in front of the occluders
+  off_screen, // entirely outside the screen
+  occluded // entirely behind the occluders
+};
+
+// Small depth buffer for software occlusion culling. A few large meshes are drawn
+// into it depth only, then the screen bounds of the other meshes are tested against it
+// to skip the ones entirely behind them before the main pass.
+// Depths are stored per 2x2 quad, so a quad is one SIMD load.
+class OcclusionBuffer {
+public:
+  /// @param width, height even
+  OcclusionBuffer(int width, int height)
+  : m_width{width},
+    m_height{height},
+    m_depth((std::size_t)(width * height), 1.0f),
+    m_triangles{}
+  {}
+
+  auto clear() -> void {
+    std::fill(m_depth.begin(), m_depth.end(), 1.0f);
+  }
+
+  // Rasterizes the triangles of the vertices, keeping the nearest depth per pixel
+  auto add_occluder(std::span<const Vertex> vertices, const Mat4f& view_projection) -> void {
+    m_triangles.clear();
+    for (auto t = std::size_t{0}; t + 2 < vertices.size(); t += 3) {
+      auto triangle = std::array<ClipVertex, 3>{};
+      for (auto v = 0u; v < 3; ++v)
+        triangle[v] = {Vec4f{vertices[t + v].position, 1.0f} * view_projection, Vertex{}};
+      add_triangle(triangle, 0, 0, m_width, m_height, m_triangles);
+    }
+
+    auto rect = Rect{0, 0, m_width, m_height};
+    for (const auto& triangle : m_triangles) {
+      rasterize_depth(triangle, rect, m_width, m_height, [&](const Quad& quad) {
+        auto* depth = &m_depth[quad_index(quad.x, quad.y)];
+        auto stored = Float4::load(depth);
+        select(quad.mask & (quad.depth < stored), quad.depth, stored).store(depth);
+      });
+    }
+  }
+
+  // Whether any part of the box may be in front of the occluders. Boxes crossing the
+  // near plane are always visible, boxes outside the screen are off screen rather than
+  // occluded. The box is tested one pixel beyond its screen bounds, since an occluder
+  // covers a pixel whose center it covers, which may be only part of it.
+  auto classify(const Bounds& bounds, const Mat4f& view_projection) const -> BoxVisibility {
+    if (bounds.empty()) return BoxVisibility::off_screen;
+
+    auto min_x = std::numeric_limits<float>::max();
+    auto min_y = std::numeric_limits<float>::max();
+    auto max_x = std::numeric_limits<float>::lowest();
+    auto max_y = std::numeric_limits<float>::lowest();
+    auto nearest = 1.0f;
+    for (auto corner = 0u; corner < 8; ++corner) {
+      auto point = Vec3f{
+        corner & 1u ? bounds.max.x : bounds.min.x,
+        corner & 2u ? bounds.max.y : bounds.min.y,
+        corner & 4u ? bounds.max.z : bounds.min.z
+      };
+      auto clip = Vec4f{point, 1.0f} * view_projection;
+      if (clip.z < -clip.w || clip.w <= 0.0f) return BoxVisibility::visible;
+      auto inv_w = 1.0f / clip.w;
+      auto x = (clip.x * inv_w * 0.5f + 0.5f) * (float)m_width;
+      auto y = (0.5f - clip.y * inv_w * 0.5f) * (float)m_height;
+      min_x = std::min(min_x, x);
+      min_y = std::min(min_y, y);
+      max_x = std::max(max_x, x);
+      max_y = std::max(max_y, y);
+      nearest = std::min(nearest, clip.z * inv_w * 0.5f + 0.5f);
+    }
+
+    auto first_x = std::max(0, (int)std::floor(std::max(min_x, -2.0f)) - 1);
+    auto first_y = std::max(0, (int)std::floor(std::max(min_y, -2.0f)) - 1);
+    auto last_x = std::min(m_width - 1, (int)std::floor(std::min(max_x, (float)m_width)) + 1);
+    auto last_y = std::min(m_height - 1, (int)std::floor(std::min(max_y, (float)m_height)) + 1);
+    if (first_x > last_x || first_y > last_y) return BoxVisibility::off_screen;
+
+    auto box_depth = Float4{nearest};
+    auto lane_x = Float4{0.0f, 1.0f, 0.0f, 1.0f};
+    auto lane_y = Float4{0.0f, 0.0f, 1.0f, 1.0f};
+    auto inside_min_x = Float4{(float)first_x};
+    auto inside_max_x = Float4{(float)last_x};
+    for (auto y = first_y & ~1; y <= last_y; y += 2) {
+      auto py = Float4{(float)y} + lane_y;
+      auto rows = (py >= Float4{(float)first_y}) & (py <= Float4{(float)last_y});
+      for (auto x = first_x & ~1; x <= last_x; x += 2) {
+        auto px = Float4{(float)x} + lane_x;
+        auto inside = rows & (px >= inside_min_x) & (px <= inside_max_x);
+        auto stored = Float4::load(&m_depth[quad_index(x, y)]);
+        if (mask_bits(inside & (box_depth <= stored)) != 0) return BoxVisibility::visible;
+      }
+    }
+    return BoxVisibility::occluded;
+  }
+
+  auto visible(const Bounds& bounds, const Mat4f& view_projection) const -> bool {
+    return classify(bounds, view_projection) == BoxVisibility::visible;
+  }
+
+  auto width() const -> int {
+    return m_width;
+  }
+
+  auto height() const -> int {
+    return m_height;
+  }
+
+private:
+  auto quad_index(int x, int y) const -> std::size_t {
+    return (std::size_t)((y / 2) * (m_width / 2) + x / 2) * 4;
+  }
+
+  int m_width;
+  int m_height;
+  std::vector<float> m_depth; // per quad, lanes in the order of Quad
+  std::vector<RasterTriangle> m_triangles; // kept between occluders to reuse their memory
+};
+
+// Indices of up to count meshes with the largest bounds, as occluders
+inline auto largest_meshes(const std::vector<Mesh>& meshes, std::size_t count) -> std::vector<std::uint32_t> {
+  auto extent = [&](std::uint32_t m) {
+    const auto& bounds = meshes[m].bounds;
+    return bounds.empty() ? 0.0f : length(bounds.max - bounds.min);
+  };
+  auto indices = std::vector<std::uint32_t>(meshes.size());
+  std::iota(indices.begin(), indices.end(), 0u);
+  count = std::min(count, indices.size());
+  std::partial_sort(indices.begin(), indices.begin() + (std::ptrdiff_t)count, indices.end(), [&](auto a, auto b) {
+    return extent(a) > extent(b);
+  });
+  indices.resize(count);
+  return indices;
+}
+
+#endif // RENDER_OCCLUSION_HPP
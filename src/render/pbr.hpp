@@ -0,0 +1,210 @@
+#ifndef RENDER_PBR_HPP
+#define RENDER_PBR_HPP
+
+#include "math/simd.hpp"
+#include "math/vector.hpp"
+#include "render/lighting.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+#include <vector>
+
+// Metallic-roughness shading: a GGX microfacet distribution with Smith masking and
+// Schlick's Fresnel approximation, and a Lambertian diffuse lobe for dielectrics.
+// The masking term and the integral of the specular lobe over the hemisphere, used
+// for the ambient light, are read from small precomputed tables.
+
+// Material parameters of four pixels
+struct PbrSurface {
+  Vec3x4 base_color{};
+  Float4 metallic{};
+  Float4 roughness{}; // perceptual roughness; the GGX alpha is its square
+};
+
+class BrdfTables {
+public:
+  static constexpr auto size = 32; // entries per axis
+  static constexpr auto environment_samples = 128u; // per entry
+
+  BrdfTables()
+  : m_masking(size * size),
+    m_environment_scale(size * size),
+    m_environment_bias(size * size)
+  {
+    for (auto j = 0; j < size; ++j) {
+      auto roughness = (float)j / (float)(size - 1);
+      for (auto i = 0; i < size; ++i) {
+        auto index = (std::size_t)(j * size + i);
+        auto cos_theta = (float)i / (float)(size - 1);
+        m_masking[index] = smith_masking(cos_theta, roughness);
+        integrate_environment(cos_theta, roughness, m_environment_scale[index], m_environment_bias[index]);
+      }
+    }
+  }
+
+  // Fraction of the microfacets visible from a direction at cos_theta to the normal
+  auto masking(Float4 cos_theta, Float4 roughness) const -> Float4 {
+    return lookup(m_masking, cos_theta, roughness);
+  }
+
+  // The specular lobe integrated over the hemisphere is F0 * scale + bias
+  auto environment(Float4 n_dot_v, Float4 roughness, Float4& scale, Float4& bias) const -> void {
+    scale = lookup(m_environment_scale, n_dot_v, roughness);
+    bias = lookup(m_environment_bias, n_dot_v, roughness);
+  }
+
+private:
+  std::vector<float> m_masking;
+  std::vector<float> m_environment_scale;
+  std::vector<float> m_environment_bias;
+
+  static auto alpha(float roughness) -> float {
+    roughness = std::max(roughness, 0.045f);
+    return roughness * roughness;
+  }
+
+  // G1 of the separable Smith GGX model
+  static auto smith_masking(float cos_theta, float roughness) -> float {
+    auto a2 = alpha(roughness) * alpha(roughness);
+    return 2.0f * cos_theta / (cos_theta + std::sqrt(a2 + (1.0f - a2) * cos_theta * cos_theta));
+  }
+
+  // The bits of i mirrored around the binary point
+  static auto radical_inverse(std::uint32_t i) -> float {
+    i = (i << 16) | (i >> 16);
+    i = ((i & 0x00ff00ffu) << 8) | ((i & 0xff00ff00u) >> 8);
+    i = ((i & 0x0f0f0f0fu) << 4) | ((i & 0xf0f0f0f0u) >> 4);
+    i = ((i & 0x33333333u) << 2) | ((i & 0xccccccccu) >> 2);
+    i = ((i & 0x55555555u) << 1) | ((i & 0xaaaaaaaau) >> 1);
+    return (float)i * 0x1p-32f;
+  }
+
+  // Importance samples the GGX distribution around the normal (0, 0, 1), with the
+  // view direction in the xz plane
+  static auto integrate_environment(float n_dot_v, float roughness, float& scale, float& bias) -> void {
+    n_dot_v = std::max(n_dot_v, 1e-3f);
+    auto v = Vec3f{std::sqrt(1.0f - n_dot_v * n_dot_v), 0.0f, n_dot_v};
+    auto a2 = alpha(roughness) * alpha(roughness);
+    auto masking_v = smith_masking(n_dot_v, roughness);
+
+    scale = 0.0f;
+    bias = 0.0f;
+    for (auto s = 0u; s < environment_samples; ++s) {
+      // Hammersley point set
+      auto u = ((float)s + 0.5f) / (float)environment_samples;
+      auto t = radical_inverse(s);
+      auto phi = 2.0f * std::numbers::pi_v<float> * u;
+      auto cos_h = std::sqrt((1.0f - t) / (1.0f + (a2 - 1.0f) * t));
+      auto sin_h = std::sqrt(1.0f - cos_h * cos_h);
+      auto h = Vec3f{sin_h * std::cos(phi), sin_h * std::sin(phi), cos_h};
+      auto v_dot_h = dot(v, h);
+      auto l = h * (2.0f * v_dot_h) - v;
+      if (l.z <= 0.0f || v_dot_h <= 0.0f) continue;
+
+      auto visibility = smith_masking(l.z, roughness) * masking_v * v_dot_h / (cos_h * n_dot_v);
+      auto fresnel = std::pow(1.0f - v_dot_h, 5.0f);
+      scale += (1.0f - fresnel) * visibility;
+      bias += fresnel * visibility;
+    }
+    scale /= (float)environment_samples;
+    bias /= (float)environment_samples;
+  }
+
+  // Bilinear lookup, both coordinates in [0, 1]
+  static auto lookup(const std::vector<float>& table, Float4 x, Float4 y) -> Float4 {
+    auto xs = std::array<float, 4>{};
+    auto ys = std::array<float, 4>{};
+    auto result = std::array<float, 4>{};
+    x.store(xs.data());
+    y.store(ys.data());
+    for (auto lane = 0u; lane < 4; ++lane) {
+      auto fx = std::clamp(xs[lane], 0.0f, 1.0f) * (float)(size - 1);
+      auto fy = std::clamp(ys[lane], 0.0f, 1.0f) * (float)(size - 1);
+      auto x0 = std::min((int)fx, size - 2);
+      auto y0 = std::min((int)fy, size - 2);
+      auto tx = fx - (float)x0;
+      auto ty = fy - (float)y0;
+      const auto* row = &table[(std::size_t)(y0 * size + x0)];
+      auto top = row[0] + (row[1] - row[0]) * tx;
+      auto bottom = row[size] + (row[size + 1] - row[size]) * tx;
+      result[lane] = top + (bottom - top) * ty;
+    }
+    return Float4::load(result.data());
+  }
+};
+
+// Built on first use
+inline auto brdf_tables() -> const BrdfTables& {
+  static const auto tables = BrdfTables{};
+  return tables;
+}
+
+// x^5 with multiplications only
+inline auto pow5(Float4 x) -> Float4 {
+  auto x2 = x * x;
+  return x2 * x2 * x;
+}
+
+// Metallic-roughness lighting of four pixels at once. Light intensities follow the
+// same convention as blinn_phong, so a white rough dielectric under a light of
+// color c facing it receives c. Normals are flipped towards the eye.
+/// @param ambient_color the material's ambient color, scaled by the ambient light
+inline auto physically_based(const PbrSurface& surface, const Vec3f& ambient_color, const std::vector<Light>& lights, const Vec3f& ambient, const Vec3f& eye, const Vec3x4& position, const Vec3x4& normal) -> Vec3x4 {
+  const auto& tables = brdf_tables();
+  auto zero = Float4{0.0f};
+  auto one = Float4{1.0f};
+  auto to_eye = normalize(Vec3x4{eye} - position);
+  auto n = normalize(normal);
+  n = select(dot(n, to_eye) < zero, n * Float4{-1.0f}, n);
+
+  auto n_dot_v = max(dot(n, to_eye), Float4{1e-4f});
+  auto roughness = max(surface.roughness, Float4{0.045f});
+  auto a2 = roughness * roughness * roughness * roughness;
+  auto masking_v = tables.masking(n_dot_v, roughness);
+  auto specular_scale = masking_v / (Float4{4.0f} * n_dot_v);
+
+  auto dielectric = one - surface.metallic;
+  auto f0 = Vec3x4{Vec3f{0.04f}} * dielectric + surface.base_color * surface.metallic;
+  auto diffuse_color = surface.base_color * dielectric;
+
+  auto color = Vec3x4{};
+  for (const auto& light : lights) {
+    auto to_light = Vec3x4{};
+    auto attenuation = one;
+    if (light.type == LightType::directional) {
+      to_light = normalize(Vec3x4{light.direction * -1.0f});
+    }
+    else {
+      to_light = Vec3x4{light.position} - position;
+      auto distance2 = dot(to_light, to_light);
+      attenuation = one / (one + distance2 * Float4{1.0f / (light.range * light.range)});
+      to_light = normalize(to_light);
+    }
+
+    auto n_dot_l = max(dot(n, to_light), zero);
+    auto half = normalize(to_light + to_eye);
+    auto n_dot_h = max(dot(n, half), zero);
+    auto v_dot_h = max(dot(to_eye, half), zero);
+
+    // pi * D, as the diffuse lobe is not divided by pi either
+    auto d = n_dot_h * n_dot_h * (a2 - one) + one;
+    auto distribution = a2 / (d * d);
+    auto fresnel_weight = pow5(one - v_dot_h);
+    auto fresnel = f0 + (Vec3x4{Vec3f{1.0f}} - f0) * fresnel_weight;
+    // n_dot_l cancels with the one in the BRDF's denominator
+    auto specular = fresnel * (distribution * tables.masking(n_dot_l, roughness) * specular_scale);
+    auto diffuse = (Vec3x4{Vec3f{1.0f}} - fresnel) * diffuse_color * n_dot_l;
+
+    color += (diffuse + specular) * Vec3x4{light.color} * attenuation;
+  }
+
+  auto scale = Float4{};
+  auto bias = Float4{};
+  tables.environment(n_dot_v, roughness, scale, bias);
+  auto ambient_specular = f0 * scale + Vec3x4{bias, bias, bias};
+  return color + (diffuse_color + ambient_specular) * Vec3x4{ambient_color * ambient};
+}
+
+#endif // RENDER_PBR_HPP
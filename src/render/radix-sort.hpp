@@ -0,0 +1,38 @@
+#ifndef RENDER_RADIX_SORT_HPP
+#define RENDER_RADIX_SORT_HPP
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+// Sort key of a non-negative depth: the upper 16 bits of the float, which order like
+// the depths themselves, with 7 bits of mantissa. Negative depths map to 0.
+inline auto depth_key(float depth) -> std::uint16_t {
+  if (!(depth > 0.0f)) return 0;
+  return (std::uint16_t)(std::bit_cast<std::uint32_t>(depth) >> 16);
+}
+
+// Fills order with the indices of keys in ascending key order, keeping the order of
+// equal keys. Two counting passes over 8-bit digits.
+/// @param scratch reused between calls to avoid allocations
+inline auto radix_sort(const std::vector<std::uint16_t>& keys, std::vector<std::uint32_t>& order, std::vector<std::uint32_t>& scratch) -> void {
+  order.resize(keys.size());
+  scratch.resize(keys.size());
+  for (auto i = 0u; i < keys.size(); ++i)
+    scratch[i] = i;
+
+  for (auto shift = 0u; shift < 16; shift += 8) {
+    auto offsets = std::array<std::uint32_t, 257>{};
+    for (auto index : scratch)
+      ++offsets[(keys[index] >> shift & 0xffu) + 1];
+    for (auto digit = 1u; digit < offsets.size(); ++digit)
+      offsets[digit] += offsets[digit - 1];
+    for (auto index : scratch)
+      order[offsets[keys[index] >> shift & 0xffu]++] = index;
+    order.swap(scratch);
+  }
+  order.swap(scratch);
+}
+
+#endif // RENDER_RADIX_SORT_HPP
@@ -0,0 +1,309 @@
+#ifndef RENDER_RASTER_HPP
+#define RENDER_RASTER_HPP
+
+#include "math/simd.hpp"
+#include "math/vector.hpp"
+#include "model/mesh.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Triangle clipping, setup and rasterization in 2x2 pixel quads.
+// Screen space: x right and y down in pixels, pixel (i, j) has its center at
+// (i + 0.5, j + 0.5); depth is in [0, 1] with 0 at the near plane.
+
+struct ClipVertex {
+  Vec4f position{}; // clip space
+  Vertex vertex{};
+};
+
+// A triangle ready for rasterization, wound so that its edge functions are positive inside
+struct RasterTriangle {
+  std::array<Vec4f, 3> screen; // x, y in pixels, z depth, w = 1 / clip space w
+  std::array<Vertex, 3> vertices;
+  std::uint32_t mesh; // index in Model::meshes()
+  std::uint32_t index; // of the triangle in the mesh, before clipping
+  int min_x; // bounds of the covered pixels, inclusive
+  int min_y;
+  int max_x;
+  int max_y;
+};
+
+// Pixel rectangle [min_x, max_x) x [min_y, max_y)
+struct Rect {
+  int min_x;
+  int min_y;
+  int max_x;
+  int max_y;
+};
+
+inline auto lerp(const ClipVertex& a, const ClipVertex& b, float t) -> ClipVertex {
+  auto vertex = Vertex{
+    a.vertex.position + (b.vertex.position - a.vertex.position) * t,
+    a.vertex.normal + (b.vertex.normal - a.vertex.normal) * t,
+    a.vertex.uv + (b.vertex.uv - a.vertex.uv) * t,
+    a.vertex.tangent + (b.vertex.tangent - a.vertex.tangent) * t
+  };
+  return {a.position + (b.position - a.position) * t, vertex};
+}
+
+// Clips a triangle against the near plane (z > -w). Returns the number of vertices
+// of the resulting polygon: 0, 3 or 4.
+inline auto clip_near(const std::array<ClipVertex, 3>& in, std::array<ClipVertex, 4>& out) -> unsigned {
+  auto count = 0u;
+  for (auto i = 0u; i < 3; ++i) {
+    const auto& a = in[i];
+    const auto& b = in[(i + 1) % 3];
+    auto da = a.position.z + a.position.w;
+    auto db = b.position.z + b.position.w;
+    if (da >= 0.0f) out[count++] = a;
+    if ((da >= 0.0f) != (db >= 0.0f)) out[count++] = lerp(a, b, da / (da - db));
+  }
+  return count;
+}
+
+// Projects a clipped triangle to the screen and appends it to out unless it covers no pixel
+/// @param reach distance from a pixel center to its farthest sample, 0 without multisampling
+inline auto setup_triangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, std::uint32_t mesh, std::uint32_t index, int width, int height, std::vector<RasterTriangle>& out, float reach = 0.0f) -> void {
+  auto project = [&](const Vec4f& p) {
+    auto inv_w = 1.0f / p.w;
+    return Vec4f{
+      (p.x * inv_w * 0.5f + 0.5f) * (float)width,
+      (0.5f - p.y * inv_w * 0.5f) * (float)height,
+      p.z * inv_w * 0.5f + 0.5f,
+      inv_w
+    };
+  };
+
+  auto triangle = RasterTriangle{{project(a.position), project(b.position), project(c.position)}, {a.vertex, b.vertex, c.vertex}, mesh, index, 0, 0, 0, 0};
+  auto& s = triangle.screen;
+  auto area = (s[1].x - s[0].x) * (s[2].y - s[0].y) - (s[1].y - s[0].y) * (s[2].x - s[0].x);
+  if (area == 0.0f || !std::isfinite(area)) return;
+  if (area < 0.0f) {
+    std::swap(s[1], s[2]);
+    std::swap(triangle.vertices[1], triangle.vertices[2]);
+  }
+
+  auto min_x = std::min({s[0].x, s[1].x, s[2].x});
+  auto min_y = std::min({s[0].y, s[1].y, s[2].y});
+  auto max_x = std::max({s[0].x, s[1].x, s[2].x});
+  auto max_y = std::max({s[0].y, s[1].y, s[2].y});
+  // pixels with a sample inside the bounds
+  triangle.min_x = std::max(0, (int)std::ceil(std::max(min_x - 0.5f - reach, -1.0f)));
+  triangle.min_y = std::max(0, (int)std::ceil(std::max(min_y - 0.5f - reach, -1.0f)));
+  triangle.max_x = std::min(width - 1, (int)std::floor(std::min(max_x - 0.5f + reach, (float)width)));
+  triangle.max_y = std::min(height - 1, (int)std::floor(std::min(max_y - 0.5f + reach, (float)height)));
+  if (triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y) return;
+
+  out.push_back(triangle);
+}
+
+// Clips, projects and appends the triangle of the three vertices. Triangles entirely
+// outside one of the side or far planes of the frustum are dropped early.
+/// @param reach see setup_triangle
+inline auto add_triangle(const std::array<ClipVertex, 3>& triangle, std::uint32_t mesh, std::uint32_t index, int width, int height, std::vector<RasterTriangle>& out, float reach = 0.0f) -> void {
+  auto outside = [&](auto&& test) {
+    return test(triangle[0].position) && test(triangle[1].position) && test(triangle[2].position);
+  };
+  if (outside([](const Vec4f& p) { return p.x < -p.w; })) return;
+  if (outside([](const Vec4f& p) { return p.x > p.w; })) return;
+  if (outside([](const Vec4f& p) { return p.y < -p.w; })) return;
+  if (outside([](const Vec4f& p) { return p.y > p.w; })) return;
+  if (outside([](const Vec4f& p) { return p.z > p.w; })) return;
+
+  auto polygon = std::array<ClipVertex, 4>{};
+  auto count = clip_near(triangle, polygon);
+  for (auto i = 2u; i < count; ++i)
+    setup_triangle(polygon[0], polygon[i - 1], polygon[i], mesh, index, width, height, out, reach);
+}
+
+// A 2x2 quad of pixels, lanes in the order top left, top right, bottom left, bottom right
+struct Quad {
+  int x; // of the top left pixel, always even
+  int y;
+  Float4 mask; // lanes covered by the triangle and on the screen
+  Float4 depth;
+  std::array<Float4, 3> weights; // perspective-correct barycentric coordinates
+};
+
+// Edge functions of a triangle: edge i is opposite vertex i, E(p) = a p.x + b p.y + c,
+// positive inside
+struct Edges {
+  std::array<float, 3> a;
+  std::array<float, 3> b;
+  std::array<float, 3> c;
+  std::array<bool, 3> top_left;
+  float inv_area;
+
+  Edges(const RasterTriangle& triangle)
+  : a{}, b{}, c{}, top_left{}, inv_area{}
+  {
+    const auto& s = triangle.screen;
+    for (auto i = 0u; i < 3; ++i) {
+      const auto& from = s[(i + 1) % 3];
+      const auto& to = s[(i + 2) % 3];
+      auto dx = to.x - from.x;
+      auto dy = to.y - from.y;
+      a[i] = -dy;
+      b[i] = dx;
+      c[i] = dy * from.x - dx * from.y;
+      top_left[i] = dy < 0.0f || (dy == 0.0f && dx > 0.0f);
+    }
+    inv_area = 1.0f / (a[0] * s[0].x + b[0] * s[0].y + c[0]);
+  }
+
+  // Stores the values at the points in e and returns mask with the points outside cleared
+  auto evaluate(Float4 px, Float4 py, Float4 mask, std::array<Float4, 3>& e) const -> Float4 {
+    auto zero = Float4{0.0f};
+    for (auto i = 0u; i < 3; ++i) {
+      e[i] = Float4{a[i]} * px + Float4{b[i]} * py + Float4{c[i]};
+      mask = mask & (top_left[i] ? e[i] >= zero : e[i] > zero);
+    }
+    return mask;
+  }
+};
+
+// Screen depth at the points of the edge function values e
+inline auto interpolate_depth(const RasterTriangle& triangle, const Edges& edges, const std::array<Float4, 3>& e) -> Float4 {
+  const auto& s = triangle.screen;
+  auto l0 = e[0] * Float4{edges.inv_area};
+  auto l1 = e[1] * Float4{edges.inv_area};
+  auto l2 = e[2] * Float4{edges.inv_area};
+  return l0 * Float4{s[0].z} + l1 * Float4{s[1].z} + l2 * Float4{s[2].z};
+}
+
+// Perspective-correct barycentric coordinates at the points of the edge function values e
+inline auto interpolate_weights(const RasterTriangle& triangle, const Edges& edges, const std::array<Float4, 3>& e) -> std::array<Float4, 3> {
+  const auto& s = triangle.screen;
+  auto w0 = e[0] * Float4{edges.inv_area} * Float4{s[0].w};
+  auto w1 = e[1] * Float4{edges.inv_area} * Float4{s[1].w};
+  auto w2 = e[2] * Float4{edges.inv_area} * Float4{s[2].w};
+  auto inv_sum = Float4{1.0f} / (w0 + w1 + w2);
+  return {w0 * inv_sum, w1 * inv_sum, w2 * inv_sum};
+}
+
+// Calls fn(const Quad&) for every quad of rect with at least one covered pixel.
+// Without interpolate, the weights of the quads are left zero.
+template<bool interpolate, typename Fn>
+inline auto rasterize_quads(const RasterTriangle& triangle, const Rect& rect, int width, int height, Fn&& fn) -> void {
+  auto edges = Edges{triangle};
+
+  auto min_x = std::max(triangle.min_x, rect.min_x) & ~1;
+  auto min_y = std::max(triangle.min_y, rect.min_y) & ~1;
+  auto max_x = std::min(triangle.max_x, rect.max_x - 1);
+  auto max_y = std::min(triangle.max_y, rect.max_y - 1);
+
+  auto zero = Float4{0.0f};
+  auto lane_x = Float4{0.5f, 1.5f, 0.5f, 1.5f};
+  auto lane_y = Float4{0.5f, 0.5f, 1.5f, 1.5f};
+  for (auto y = min_y; y <= max_y; y += 2) {
+    auto py = Float4{(float)y} + lane_y;
+    auto rows = py < Float4{(float)height};
+    for (auto x = min_x; x <= max_x; x += 2) {
+      auto px = Float4{(float)x} + lane_x;
+      std::array<Float4, 3> e;
+      auto mask = edges.evaluate(px, py, rows & (px < Float4{(float)width}), e);
+      if (mask_bits(mask) == 0) continue;
+
+      auto depth = interpolate_depth(triangle, edges, e);
+      if constexpr (interpolate)
+        fn(Quad{x, y, mask, depth, interpolate_weights(triangle, edges, e)});
+      else
+        fn(Quad{x, y, mask, depth, {zero, zero, zero}});
+    }
+  }
+}
+
+// Calls shade(const Quad&) for every quad of rect with at least one covered pixel.
+// Edges follow the top-left rule, so pixels on an edge shared by two triangles are
+// covered by exactly one of them.
+/// @param rect must start at even coordinates; the screen size clips the last quads
+template<typename Fn>
+inline auto rasterize(const RasterTriangle& triangle, const Rect& rect, int width, int height, Fn&& shade) -> void {
+  rasterize_quads<true>(triangle, rect, width, height, shade);
+}
+
+// Like rasterize, for depth-only passes: the quads have no weights. Their depths are
+// bit for bit the ones rasterize gives, so a later pass can test for equality.
+template<typename Fn>
+inline auto rasterize_depth(const RasterTriangle& triangle, const Rect& rect, int width, int height, Fn&& fn) -> void {
+  rasterize_quads<false>(triangle, rect, width, height, fn);
+}
+
+// Sample positions of 4x multisampling relative to the pixel center, on a rotated grid
+constexpr auto sample_offsets = std::array<std::array<float, 2>, 4>{{
+  {-0.125f, -0.375f},
+  {0.375f, -0.125f},
+  {-0.375f, 0.125f},
+  {0.125f, 0.375f}
+}};
+
+// Reach of the samples for setup_triangle
+constexpr auto sample_reach = 0.375f;
+
+// A 2x2 quad of 4x multisampled pixels
+struct MultisampleQuad {
+  Quad pixels; // mask of the pixels with a covered sample, depth and weights at their centers
+  std::array<Float4, 4> masks; // per sample, lanes covered by the triangle and on the screen
+  std::array<Float4, 4> depths; // per sample
+};
+
+// Like rasterize_quads, with coverage and depth evaluated at each sample. The weights
+// are those of the pixel centers, extrapolated where the center is outside the triangle.
+template<bool interpolate, typename Fn>
+inline auto rasterize_multisample_quads(const RasterTriangle& triangle, const Rect& rect, int width, int height, Fn&& fn) -> void {
+  auto edges = Edges{triangle};
+
+  auto min_x = std::max(triangle.min_x, rect.min_x) & ~1;
+  auto min_y = std::max(triangle.min_y, rect.min_y) & ~1;
+  auto max_x = std::min(triangle.max_x, rect.max_x - 1);
+  auto max_y = std::min(triangle.max_y, rect.max_y - 1);
+
+  auto zero = Float4{0.0f};
+  auto lane_x = Float4{0.5f, 1.5f, 0.5f, 1.5f};
+  auto lane_y = Float4{0.5f, 0.5f, 1.5f, 1.5f};
+  for (auto y = min_y; y <= max_y; y += 2) {
+    auto py = Float4{(float)y} + lane_y;
+    auto rows = py < Float4{(float)height};
+    for (auto x = min_x; x <= max_x; x += 2) {
+      auto px = Float4{(float)x} + lane_x;
+      auto on_screen = rows & (px < Float4{(float)width});
+
+      auto masks = std::array<Float4, 4>{zero, zero, zero, zero};
+      auto depths = std::array<Float4, 4>{zero, zero, zero, zero};
+      auto covered = zero;
+      std::array<Float4, 3> e;
+      for (auto sample = 0u; sample < 4; ++sample) {
+        auto [dx, dy] = sample_offsets[sample];
+        masks[sample] = edges.evaluate(px + Float4{dx}, py + Float4{dy}, on_screen, e);
+        depths[sample] = interpolate_depth(triangle, edges, e);
+        covered = covered | masks[sample];
+      }
+      if (mask_bits(covered) == 0) continue;
+
+      edges.evaluate(px, py, on_screen, e);
+      auto depth = interpolate_depth(triangle, edges, e);
+      if constexpr (interpolate)
+        fn(MultisampleQuad{Quad{x, y, covered, depth, interpolate_weights(triangle, edges, e)}, masks, depths});
+      else
+        fn(MultisampleQuad{Quad{x, y, covered, depth, {zero, zero, zero}}, masks, depths});
+    }
+  }
+}
+
+// Calls shade(const MultisampleQuad&) for every quad of rect with at least one covered
+// sample. The triangle must have been set up with sample_reach.
+template<typename Fn>
+inline auto rasterize_multisample(const RasterTriangle& triangle, const Rect& rect, int width, int height, Fn&& shade) -> void {
+  rasterize_multisample_quads<true>(triangle, rect, width, height, shade);
+}
+
+// Like rasterize_multisample, for depth-only passes
+template<typename Fn>
+inline auto rasterize_multisample_depth(const RasterTriangle& triangle, const Rect& rect, int width, int height, Fn&& fn) -> void {
+  rasterize_multisample_quads<false>(triangle, rect, width, height, fn);
+}
+
+#endif // RENDER_RASTER_HPP
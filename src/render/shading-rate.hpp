@@ -0,0 +1,117 @@
+#ifndef RENDER_SHADING_RATE_HPP
+#define RENDER_SHADING_RATE_HPP
+
+#include "math/vector.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Pixels per side of a coarse pixel, which is shaded once
+enum class ShadingRate : std::uint8_t {
+  one_by_one = 1,
+  two_by_two = 2,
+  four_by_four = 4
+};
+
+enum class ShadingRateSource {
+  none, // every pixel is shaded
+  luminance, // coarser where the luminance of the last frame changes slowly
+  foveated // coarser with the distance from a point of the screen
+};
+
+// Shading rate per tile of tile_size pixels of the screen
+class ShadingRateImage {
+public:
+  static constexpr auto tile_size = 16; // pixels, a multiple of the coarsest 2x2 quads
+
+  ShadingRateImage(int width, int height)
+  : m_width{width},
+    m_height{height},
+    m_tiles_x{(width + tile_size - 1) / tile_size},
+    m_rates((std::size_t)(m_tiles_x * ((height + tile_size - 1) / tile_size)), ShadingRate::one_by_one)
+  {}
+
+  // Every tile is back at the full rate
+  auto resize(int width, int height) -> void {
+    m_width = width;
+    m_height = height;
+    m_tiles_x = (width + tile_size - 1) / tile_size;
+    m_rates.assign((std::size_t)(m_tiles_x * ((height + tile_size - 1) / tile_size)), ShadingRate::one_by_one);
+  }
+
+  // Of the tile containing pixel (x, y)
+  auto rate(int x, int y) const -> ShadingRate {
+    return m_rates[(std::size_t)((y / tile_size) * m_tiles_x + x / tile_size)];
+  }
+
+  // Full rate within foveal_radius of center, in [0, 1] of the screen, and coarser
+  // beyond. Distances are in screen heights, so the regions are round.
+  auto set_foveated(const Vec2f& center) -> void {
+    auto tiles_y = (int)(m_rates.size() / (std::size_t)m_tiles_x);
+    for (auto ty = 0; ty < tiles_y; ++ty) {
+      for (auto tx = 0; tx < m_tiles_x; ++tx) {
+        auto x = ((float)tx + 0.5f) * (float)tile_size - center.x * (float)m_width;
+        auto y = ((float)ty + 0.5f) * (float)tile_size - center.y * (float)m_height;
+        auto distance = std::sqrt(x * x + y * y) / (float)m_height;
+        m_rates[(std::size_t)(ty * m_tiles_x + tx)] =
+          distance < foveal_radius ? ShadingRate::one_by_one :
+          distance < parafoveal_radius ? ShadingRate::two_by_two : ShadingRate::four_by_four;
+      }
+    }
+  }
+
+  // Rates from the luma differences between neighbouring pixels of a frame of this
+  // size, packed as RGBA. A coarse pixel is off by about the luma gradient times its
+  // size, so each tile gets the coarsest rate keeping that under max_error. The
+  // gradient is measured between the coarse pixels the frame was shaded with, so it
+  // does not depend on the rate it chooses.
+  auto set_from_luminance(const std::vector<std::uint32_t>& colors) -> void {
+    auto luma = [&](int x, int y) {
+      auto color = colors[(std::size_t)(y * m_width + x)];
+      return (0.2126f * (float)(color >> 24) + 0.7152f * (float)(color >> 16 & 0xffu) + 0.0722f * (float)(color >> 8 & 0xffu)) / 255.0f;
+    };
+
+    auto tiles_y = (int)(m_rates.size() / (std::size_t)m_tiles_x);
+    parallel_for((std::size_t)tiles_y, [&](std::size_t row) {
+      auto ty = (int)row;
+      for (auto tx = 0; tx < m_tiles_x; ++tx) {
+        auto& rate = m_rates[(std::size_t)(ty * m_tiles_x + tx)];
+        auto step = (int)rate;
+        auto max_x = std::min((tx + 1) * tile_size, m_width);
+        auto max_y = std::min((ty + 1) * tile_size, m_height);
+        auto sum = 0.0f;
+        auto count = 0;
+        for (auto y = ty * tile_size; y < max_y; y += step) {
+          for (auto x = tx * tile_size; x < max_x; x += step) {
+            auto center = luma(x, y);
+            if (x + step < max_x) {
+              sum += std::abs(luma(x + step, y) - center);
+              ++count;
+            }
+            if (y + step < max_y) {
+              sum += std::abs(luma(x, y + step) - center);
+              ++count;
+            }
+          }
+        }
+        auto gradient = count == 0 ? 0.0f : sum / (float)(count * step); // per pixel
+        rate = gradient * 4.0f < max_error ? ShadingRate::four_by_four :
+               gradient * 2.0f < max_error ? ShadingRate::two_by_two : ShadingRate::one_by_one;
+      }
+    });
+  }
+
+private:
+  static constexpr auto foveal_radius = 0.25f;
+  static constexpr auto parafoveal_radius = 0.5f;
+  static constexpr auto max_error = 0.01f; // of luma in [0, 1]
+
+  int m_width;
+  int m_height;
+  int m_tiles_x;
+  std::vector<ShadingRate> m_rates;
+};
+
+#endif // RENDER_SHADING_RATE_HPP
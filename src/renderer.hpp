@@ -4,17 +4,131 @@
 #include "camera.hpp"
 #include "math/vector.hpp"
 #include "math/matrix.hpp"
+#include "math/simd.hpp"
+#include "math/srgb.hpp"
 #include "model/model.hpp"
+#include "parallel.hpp"
+#include "render/gbuffer.hpp"
+#include "render/lighting.hpp"
+#include "render/occlusion.hpp"
+#include "render/pbr.hpp"
+#include "render/radix-sort.hpp"
+#include "render/raster.hpp"
+#include "render/shading-rate.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
 #include <vector>
 #include <cstdint>
 #include <cassert>
+#include <limits>
 
+enum class RenderMode {
+  forward, // fragments are shaded as they are rasterized
+  deferred, // a geometry pass fills a G-buffer, then every covered pixel is shaded once
+  visibility // a raster pass stores the visible triangle per pixel, then every covered pixel is shaded once
+};
+
+// Work done by the last frame, in fragments (pixels covered by a triangle). With a
+// depth prepass, fragments and depth_passed are counted in the prepass.
+// Times are in seconds, summed over the threads.
+struct RenderStats {
+  std::size_t culled_meshes{}; // hidden behind the occluders
+  std::size_t off_screen_meshes{}; // skipped with the occluders for being outside the screen
+  std::size_t reused{}; // pixels reprojected from the previous frame
+  std::size_t reshaded{}; // pixels shaded again with temporal reuse
+  std::size_t reconstructed{}; // pixels filled from their neighbours with checkerboard rendering
+  std::size_t coarse_saved{}; // pixels given the color of their coarse pixel instead of shading them
+  double occluder_time{}; // rasterizing the occluders
+  std::size_t fragments{}; // rasterized
+  std::size_t depth_passed{}; // passed the depth test when rasterized
+  std::size_t shaded{}; // lit
+  std::size_t pixels{}; // covered when the frame was done
+  double prepass_time{}; // in the depth prepass
+  double shading_time{}; // in the passes after it
+
+  // Fragments written per covered pixel
+  auto overdraw() const -> float {
+    return pixels == 0 ? 0.0f : (float)depth_passed / (float)pixels;
+  }
+
+  auto operator+=(const RenderStats& other) -> RenderStats& {
+    culled_meshes += other.culled_meshes;
+    off_screen_meshes += other.off_screen_meshes;
+    reused += other.reused;
+    reshaded += other.reshaded;
+    reconstructed += other.reconstructed;
+    coarse_saved += other.coarse_saved;
+    occluder_time += other.occluder_time;
+    fragments += other.fragments;
+    depth_passed += other.depth_passed;
+    shaded += other.shaded;
+    pixels += other.pixels;
+    prepass_time += other.prepass_time;
+    shading_time += other.shading_time;
+    return *this;
+  }
+};
+
+// Renders filled, depth-tested triangles with per-pixel Blinn-Phong or, for
+// metallic-roughness materials, physically based lighting.
+// Triangles are transformed and set up in parallel chunks, binned into screen tiles,
+// and the tiles are then rasterized in parallel, each by a single thread, with the
+// nearest chunks first. Pixels are shaded four at a time as 2x2 quads, which also gives
+// the uv derivatives for texture filtering.
 class Renderer {
 public:
-  Renderer(int width, int height) 
-  : m_width{width}, 
+  Renderer(int width, int height)
+  : m_width{width},
     m_height{height},
-    m_colorbuffer((unsigned)(width * height), 0)
+    m_mode{RenderMode::forward},
+    m_depth_prepass{false},
+    m_sort_front_to_back{true},
+    m_multisample{false},
+    m_temporal_reuse{false},
+    m_checkerboard{false},
+    m_checkerboard_parity{0},
+    m_history_valid{false},
+    m_up_to_date{false},
+    m_model_version{0},
+    m_previous_view_projection{},
+    m_shading_rate_source{ShadingRateSource::none},
+    m_foveation_center{0.5f},
+    m_shading_rates{width, height},
+    m_occlusion{256, 128},
+    m_occluders{},
+    m_visible_meshes{},
+    m_colorbuffer((unsigned)(width * height), 0),
+    m_depthbuffer((unsigned)(width * height), 1.0f),
+    m_gbuffer{},
+    m_visibility{},
+    m_sample_depths{},
+    m_sample_colors{},
+    m_uncompressed{},
+    m_previous_colors{},
+    m_previous_depths{},
+    m_history_ages{},
+    m_previous_ages{},
+    m_reshade{},
+    m_triangle_bits{32},
+    m_lights{},
+    m_ambient{1.0f},
+    m_sampler{},
+    m_chunks{},
+    m_tile_offsets{},
+    m_tile_runs{},
+    m_sort_keys{},
+    m_draw_order{},
+    m_sort_scratch{},
+    m_textures{},
+    m_tile_stats{},
+    m_stats{}
   {}
 
   auto set_color(int x, int y, const Vec4f& color) -> void {
@@ -28,86 +142,1247 @@ public:
   }
 
   auto resize(int width, int height) -> void {
+    m_up_to_date = false;
     m_width = width;
     m_height = height;
     m_colorbuffer.resize((unsigned)(width * height), 0);
+    m_depthbuffer.resize((unsigned)(width * height), 1.0f);
+    m_shading_rates.resize(width, height);
+    if (!m_gbuffer.empty()) m_gbuffer.resize((unsigned)(width * height));
+    if (!m_visibility.empty()) m_visibility.resize((unsigned)(width * height));
+    m_history_valid = false;
+    if (!m_uncompressed.empty()) {
+      m_sample_depths.resize(sample_count());
+      m_sample_colors.resize(sample_count());
+      m_uncompressed.resize((unsigned)(width * height));
+    }
   }
 
-  auto render(const Camera& camera, const Model& model) -> void {
-    auto view = camera.view_matrix();
-    auto projection = camera.projection_matrix();
-
-    std::fill(m_colorbuffer.begin(), m_colorbuffer.end(), 0); // Clear to black
-
-    for (const auto& mesh : model.meshes()) {
-      for (auto i = 0u; i < mesh.vertices.size(); i += 3) {
-        const auto& v0 = mesh.vertices[i + 0];
-        const auto& v1 = mesh.vertices[i + 1];
-        const auto& v2 = mesh.vertices[i + 2];
-
-        auto pos0_clip = Vec4f{v0.position, 1.0f} * view * projection;
-        auto pos1_clip = Vec4f{v1.position, 1.0f} * view * projection;
-        auto pos2_clip = Vec4f{v2.position, 1.0f} * view * projection;
-
-        // perform clipping
-
-        auto pos0_ndc = pos0_clip.xyz() / pos0_clip.w;
-        auto pos1_ndc = pos1_clip.xyz() / pos1_clip.w;
-        auto pos2_ndc = pos2_clip.xyz() / pos2_clip.w;
-
-        auto pos0_screen = (pos0_ndc + Vec3f{1.0f}) * 0.5f;
-        auto pos1_screen = (pos1_ndc + Vec3f{1.0f}) * 0.5f;
-        auto pos2_screen = (pos2_ndc + Vec3f{1.0f}) * 0.5f;
-        pos0_screen.x *= m_width - 1;
-        pos0_screen.y = (1.0f - pos0_screen.y) * (m_height - 1);
-        pos1_screen.x *= m_width - 1;
-        pos1_screen.y = (1.0f - pos1_screen.y) * (m_height - 1);
-        pos2_screen.x *= m_width - 1;
-        pos2_screen.y = (1.0f - pos2_screen.y) * (m_height - 1);
-
-        auto draw_line = [&](const Vec3f& p0, const Vec3f& p1) {
-          // Bresenham's line algorithm
-          auto x0 = (int)std::round(p0.x);
-          auto y0 = (int)std::round(p0.y);
-          auto x1 = (int)std::round(p1.x);
-          auto y1 = (int)std::round(p1.y);
-
-          auto dx = std::abs(x1 - x0);
-          auto dy = std::abs(y1 - y0);
-          auto sx = x0 < x1 ? 1 : -1;
-          auto sy = y0 < y1 ? 1 : -1;
-          auto err = dx - dy;
-
-          while (true) {
-            if (x0 >= 0 && x0 < m_width && y0 >= 0 && y0 < m_height)
-              set_color(x0, y0, Vec4f{mesh.material.diffuse, 1.0f});
-            if (x0 == x1 && y0 == y1) break;
-            auto err2 = err * 2;
-            if (err2 > -dy) {
-              err -= dy;
-              x0 += sx;
-            }
-            if (err2 < dx) {
-              err += dx;
-              y0 += sy;
+  auto width() const -> int {
+    return m_width;
+  }
+
+  auto height() const -> int {
+    return m_height;
+  }
+
+  // The G-buffer and the visibility buffer are allocated by the first frame that uses them
+  auto set_mode(RenderMode mode) -> void {
+    m_up_to_date = false;
+    m_mode = mode;
+    m_history_valid = false;
+  }
+
+  auto mode() const -> RenderMode {
+    return m_mode;
+  }
+
+  // Whether forward shading first rasterizes the depth of every triangle and then
+  // shades only the fragments at the final depth, so no fragment is shaded twice
+  auto set_depth_prepass(bool enabled) -> void {
+    m_up_to_date = false;
+    m_depth_prepass = enabled;
+  }
+
+  auto depth_prepass() const -> bool {
+    return m_depth_prepass;
+  }
+
+  // Whether chunks of triangles are rasterized nearest first, so more of the hidden
+  // fragments fail the depth test before being shaded. On by default.
+  auto set_sort_front_to_back(bool enabled) -> void {
+    m_up_to_date = false;
+    m_sort_front_to_back = enabled;
+  }
+
+  auto sort_front_to_back() const -> bool {
+    return m_sort_front_to_back;
+  }
+
+  // Whether forward shading uses 4x multisampling: coverage and depth per sample,
+  // shading once per pixel and triangle. A pixel whose samples all come from one
+  // triangle keeps a single color; only the others are flagged uncompressed and store
+  // a color per sample, until each tile is resolved. Ignored by the other modes.
+  auto set_multisample(bool enabled) -> void {
+    m_up_to_date = false;
+    m_multisample = enabled;
+  }
+
+  auto multisample() const -> bool {
+    return m_multisample;
+  }
+
+  // Whether forward shading reuses the colors of the previous frame. After a depth
+  // prepass, every pixel is reprojected into the previous frame and keeps the color
+  // found there when the surface at that pixel was the same one. Only the others are
+  // shaded again, along with pixels reused for max_history_age frames, so view
+  // dependent lighting catches up. Ignored with multisampling and by the other modes.
+  auto set_temporal_reuse(bool enabled) -> void {
+    m_up_to_date = false;
+    m_temporal_reuse = enabled;
+    m_history_valid = false;
+  }
+
+  auto temporal_reuse() const -> bool {
+    return m_temporal_reuse;
+  }
+
+  // Whether forward shading shades only every other 2x2 quad, alternating each frame
+  // like the squares of a checkerboard. After a depth prepass, the pixels of the other
+  // quads keep their reprojected color from the previous frame, as with temporal
+  // reuse, if it was shaded at most max_checkerboard_age frames ago; the rest are
+  // reconstructed from the shaded pixels next to them. A frame with reconstructed
+  // pixels is followed by another one even if nothing changed, which completes the
+  // image. Ignored with temporal reuse, multisampling and by the other modes.
+  auto set_checkerboard(bool enabled) -> void {
+    m_up_to_date = false;
+    m_checkerboard = enabled;
+    m_history_valid = false;
+  }
+
+  auto checkerboard() const -> bool {
+    return m_checkerboard;
+  }
+
+  // Variable rate shading for the visibility mode: what chooses the shading rate of
+  // each tile of ShadingRateImage::tile_size pixels. With luminance, the rates come
+  // from the frame before, so the first frame is shaded at full rate. Ignored by the
+  // other modes. None by default.
+  auto set_shading_rate_source(ShadingRateSource source) -> void {
+    m_up_to_date = false;
+    m_shading_rate_source = source;
+    m_shading_rates.resize(m_width, m_height);
+  }
+
+  auto shading_rate_source() const -> ShadingRateSource {
+    return m_shading_rate_source;
+  }
+
+  // Where foveated rates are full, in [0, 1] of the screen from the top left. The
+  // center by default.
+  auto set_foveation_center(const Vec2f& center) -> void {
+    m_up_to_date = false;
+    m_foveation_center = center;
+  }
+
+  // Meshes drawn into a small depth buffer before each frame, by index in
+  // Model::meshes(). The other meshes are skipped when their bounds are entirely
+  // behind them. None by default.
+  auto set_occluders(std::vector<std::uint32_t> meshes) -> void {
+    m_up_to_date = false;
+    m_occluders = std::move(meshes);
+  }
+
+  auto occluders() const -> const std::vector<std::uint32_t>& {
+    return m_occluders;
+  }
+
+  auto set_lights(std::vector<Light> lights) -> void {
+    m_up_to_date = false;
+    m_lights = std::move(lights);
+    m_history_valid = false;
+  }
+
+  auto lights() const -> const std::vector<Light>& {
+    return m_lights;
+  }
+
+  // Color of the light that reaches every surface, scaled by the material's ambient color
+  auto set_ambient(const Vec3f& ambient) -> void {
+    m_up_to_date = false;
+    m_ambient = ambient;
+    m_history_valid = false;
+  }
+
+  // Used for every texture
+  auto set_sampler(const Sampler& sampler) -> void {
+    m_up_to_date = false;
+    m_sampler = sampler;
+    m_history_valid = false;
+  }
+
+  // Skips the frame and returns false when neither the camera, nor the model, nor any
+  // setting changed since the last one, so the color buffer is still current. The
+  // caller clears the camera's dirty flag once it has rendered with it.
+  auto render(const Camera& camera, const Model& model) -> bool {
+    if (m_up_to_date && !camera.dirty() && model.version() == m_model_version) return false;
+    // the colors of the last frame show the model as it was, e.g. before textures loaded
+    if (model.version() != m_model_version) m_history_valid = false;
+    m_up_to_date = true;
+    m_model_version = model.version();
+
+    auto view_projection = camera.view_matrix() * camera.projection_matrix();
+    const auto& meshes = model.meshes();
+
+    // resolved once per mesh; nullptr while the texture is not loaded
+    auto find = [&](const std::optional<std::string>& name) { return name ? model.find_texture(*name) : nullptr; };
+    m_textures.clear();
+    for (const auto& mesh : meshes) {
+      const auto& material = mesh.material;
+      m_textures.push_back({
+        find(material.diffuse_texture),
+        find(material.normal_texture),
+        find(material.metallic_roughness_texture),
+        find(material.emissive_texture)
+      });
+    }
+
+    auto occlusion_stats = cull_occluded(meshes, view_projection);
+
+    // transform and set up triangles of the visible meshes in chunks of at most chunk_size
+    auto ranges = std::vector<std::array<std::size_t, 3>>{}; // mesh, first and last triangle
+    for (auto m = 0u; m < meshes.size(); ++m) {
+      if (!m_visible_meshes[m]) continue;
+      auto triangles = meshes[m].vertices.size() / 3;
+      for (auto first = std::size_t{0}; first < triangles; first += chunk_size)
+        ranges.push_back({m, first, std::min(first + chunk_size, triangles)});
+    }
+    m_chunks.resize(ranges.size());
+
+    auto multisample = m_multisample && m_mode == RenderMode::forward;
+    if (multisample) {
+      m_sample_depths.resize(sample_count());
+      m_sample_colors.resize(sample_count());
+      m_uncompressed.resize(m_colorbuffer.size());
+    }
+
+    auto tiles_x = (m_width + tile_size - 1) / tile_size;
+    auto tiles_y = (m_height + tile_size - 1) / tile_size;
+    auto tile_count = (std::size_t)(tiles_x * tiles_y);
+
+    parallel_for(ranges.size(), [&](std::size_t i) {
+      auto [m, first, last] = ranges[i];
+      auto& chunk = m_chunks[i];
+      chunk.triangles.clear();
+      auto nearest = std::numeric_limits<float>::max();
+      auto farthest = std::numeric_limits<float>::lowest();
+      for (auto t = first; t < last; ++t) {
+        auto triangle = std::array<ClipVertex, 3>{};
+        for (auto v = 0u; v < 3; ++v) {
+          const auto& vertex = meshes[m].vertices[t * 3 + v];
+          triangle[v] = {Vec4f{vertex.position, 1.0f} * view_projection, vertex};
+          nearest = std::min(nearest, triangle[v].position.w);
+          farthest = std::max(farthest, triangle[v].position.w);
+        }
+        add_triangle(triangle, (std::uint32_t)m, (std::uint32_t)t, m_width, m_height, chunk.triangles, multisample ? sample_reach : 0.0f);
+      }
+      chunk.depth = (nearest + farthest) * 0.5f;
+
+      // (tile, triangle) pairs sorted by tile, so each overlapped tile gets a run
+      chunk.refs.clear();
+      for (auto t = 0u; t < chunk.triangles.size(); ++t) {
+        const auto& triangle = chunk.triangles[t];
+        for (auto ty = triangle.min_y / tile_size; ty <= triangle.max_y / tile_size; ++ty) {
+          for (auto tx = triangle.min_x / tile_size; tx <= triangle.max_x / tile_size; ++tx)
+            chunk.refs.push_back((std::uint64_t)(ty * tiles_x + tx) << 32 | t);
+        }
+      }
+      std::ranges::sort(chunk.refs);
+    });
+
+    // draw order of the chunks, by the view depth of the center of their bounds
+    m_sort_keys.resize(m_chunks.size());
+    for (auto i = 0u; i < m_chunks.size(); ++i)
+      m_sort_keys[i] = m_sort_front_to_back ? depth_key(m_chunks[i].depth) : 0;
+    radix_sort(m_sort_keys, m_draw_order, m_sort_scratch);
+    bin_chunks(tile_count);
+
+    if (m_mode == RenderMode::deferred) m_gbuffer.resize(m_colorbuffer.size());
+    if (m_mode == RenderMode::visibility) {
+      m_visibility.resize(m_colorbuffer.size());
+      set_visibility_packing(meshes);
+    }
+    m_tile_stats.assign(tile_count, RenderStats{});
+
+    // the previous frame becomes the history, the current buffers are cleared per tile
+    auto reuse = m_temporal_reuse && m_mode == RenderMode::forward && !multisample;
+    auto checkerboard = m_checkerboard && !reuse && m_mode == RenderMode::forward && !multisample;
+    auto history = reuse || checkerboard;
+    auto inverse_view_projection = inverse(view_projection);
+    auto previous_inverse = inverse(m_previous_view_projection);
+    auto reprojection = inverse_view_projection * m_previous_view_projection;
+    if (checkerboard) m_checkerboard_parity ^= 1u;
+    if (history) {
+      std::swap(m_colorbuffer, m_previous_colors);
+      std::swap(m_depthbuffer, m_previous_depths);
+      std::swap(m_history_ages, m_previous_ages);
+      m_colorbuffer.resize(m_previous_colors.size());
+      m_depthbuffer.resize(m_previous_depths.size());
+      m_history_ages.resize(m_previous_colors.size());
+      m_reshade.resize(m_previous_colors.size());
+      if (m_previous_ages.size() != m_previous_colors.size()) m_history_valid = false;
+    }
+    else {
+      m_history_valid = false;
+    }
+
+    auto eye = camera.position;
+    auto prepass = (m_depth_prepass || history) && m_mode == RenderMode::forward;
+    parallel_for(tile_count, [&](std::size_t tile) {
+      auto rect = tile_rect(tile, tiles_x);
+      auto& stats = m_tile_stats[tile];
+      clear(rect);
+      if (multisample) clear_samples(rect);
+
+      if (prepass) {
+        auto timer = Timer{};
+        for (const auto& run : tile_runs(tile)) {
+          const auto& chunk = m_chunks[run.chunk];
+          for (auto r = run.first; r < run.last; ++r) {
+            auto t = (std::uint32_t)chunk.refs[r];
+            if (multisample) {
+              rasterize_multisample_depth(chunk.triangles[t], rect, m_width, m_height, [&](const MultisampleQuad& quad) {
+                auto samples = sample_depth_test(quad);
+                write_sample_depths(quad);
+                stats.fragments += (std::size_t)std::popcount(mask_bits(quad.pixels.mask));
+                stats.depth_passed += (std::size_t)std::popcount(sample_lanes(samples));
+              });
+              continue;
             }
+            rasterize_depth(chunk.triangles[t], rect, m_width, m_height, [&](const Quad& quad) {
+              auto indices = lane_indices(quad.x, quad.y);
+              auto visible = depth_test(quad, indices);
+              write_depth(quad, indices, visible);
+              stats.fragments += (std::size_t)std::popcount(mask_bits(quad.mask));
+              stats.depth_passed += (std::size_t)std::popcount(visible);
+            });
           }
-        };
-        draw_line(pos0_screen, pos1_screen);
-        draw_line(pos1_screen, pos2_screen);
-        draw_line(pos2_screen, pos0_screen);
+        }
+        stats.prepass_time = timer.elapsed();
       }
+
+      auto timer = Timer{};
+      if (reuse) reproject(rect, inverse_view_projection, reprojection, previous_inverse, stats);
+      if (checkerboard) reproject_checkerboard(rect, inverse_view_projection, reprojection, previous_inverse, stats);
+      for (const auto& run : tile_runs(tile)) {
+        const auto& chunk = m_chunks[run.chunk];
+        for (auto r = run.first; r < run.last; ++r) {
+          auto t = (std::uint32_t)chunk.refs[r];
+          const auto& triangle = chunk.triangles[t];
+          const auto& material = meshes[triangle.mesh].material;
+          const auto& textures = m_textures[triangle.mesh];
+          if (multisample) {
+            rasterize_multisample(triangle, rect, m_width, m_height, [&](const MultisampleQuad& quad) {
+              auto visible = shade_multisample(quad, triangle, material, textures, eye, prepass);
+              if (prepass) {
+                stats.shaded += (std::size_t)std::popcount(visible);
+                return;
+              }
+              stats.fragments += (std::size_t)std::popcount(mask_bits(quad.pixels.mask));
+              stats.depth_passed += (std::size_t)std::popcount(visible);
+            });
+            continue;
+          }
+          rasterize(triangle, rect, m_width, m_height, [&](const Quad& quad) {
+            if (history) {
+              auto remaining = quad;
+              remaining.mask = quad.mask & reshade_mask(quad);
+              if (mask_bits(remaining.mask) != 0)
+                stats.shaded += (std::size_t)std::popcount(shade(remaining, triangle, material, textures, eye, true));
+              return;
+            }
+            if (prepass) {
+              stats.shaded += (std::size_t)std::popcount(shade(quad, triangle, material, textures, eye, true));
+              return;
+            }
+
+            auto visible = 0u;
+            switch (m_mode) {
+              case RenderMode::forward: visible = shade(quad, triangle, material, textures, eye, false); break;
+              case RenderMode::deferred: visible = write_gbuffer(quad, triangle, textures); break;
+              case RenderMode::visibility: visible = write_visibility(quad, triangle); break;
+            }
+            stats.fragments += (std::size_t)std::popcount(mask_bits(quad.mask));
+            stats.depth_passed += (std::size_t)std::popcount(visible);
+          });
+        }
+      }
+      if (m_mode == RenderMode::forward && !prepass) stats.shaded = stats.depth_passed;
+      if (multisample) resolve(rect);
+      stats.shading_time = timer.elapsed();
+    });
+
+    // the pixels of other tiles next to the reconstructed ones must be shaded first
+    if (checkerboard) {
+      parallel_for(tile_count, [&](std::size_t tile) {
+        auto timer = Timer{};
+        m_tile_stats[tile].reconstructed = reconstruct(tile_rect(tile, tiles_x), inverse_view_projection);
+        m_tile_stats[tile].shading_time += timer.elapsed();
+      });
+    }
+
+    if (history) {
+      m_previous_view_projection = view_projection;
+      m_history_valid = true;
+    }
+
+    if (m_mode == RenderMode::deferred) {
+      parallel_for(tile_count, [&](std::size_t tile) {
+        auto timer = Timer{};
+        m_tile_stats[tile].shaded = shade_gbuffer(tile_rect(tile, tiles_x), meshes, inverse_view_projection, eye);
+        m_tile_stats[tile].shading_time += timer.elapsed();
+      });
+    }
+    else if (m_mode == RenderMode::visibility) {
+      if (m_shading_rate_source == ShadingRateSource::foveated) m_shading_rates.set_foveated(m_foveation_center);
+      parallel_for(tile_count, [&](std::size_t tile) {
+        auto timer = Timer{};
+        resolve_visibility(tile_rect(tile, tiles_x), meshes, view_projection, eye, m_tile_stats[tile]);
+        m_tile_stats[tile].shading_time += timer.elapsed();
+      });
+      if (m_shading_rate_source == ShadingRateSource::luminance) m_shading_rates.set_from_luminance(m_colorbuffer);
+    }
+
+    m_stats = occlusion_stats;
+    for (auto tile = 0u; tile < tile_count; ++tile) {
+      m_tile_stats[tile].pixels = covered_pixels(tile_rect(tile, tiles_x));
+      m_stats += m_tile_stats[tile];
     }
+    if (m_stats.reconstructed > 0) m_up_to_date = false;
+    return true;
   }
 
   auto colorbuffer() const -> const std::vector<std::uint32_t>& {
     return m_colorbuffer;
   }
 
+  // Of the last rendered frame
+  auto stats() const -> const RenderStats& {
+    return m_stats;
+  }
+
 private:
+  // Transformed triangles of a range of a mesh and the tiles they overlap
+  struct Chunk {
+    std::vector<RasterTriangle> triangles{};
+    std::vector<std::uint64_t> refs{}; // tile << 32 | triangle, sorted
+    float depth{}; // view depth of the center of the bounds, negative if behind the eye
+  };
+
+  // The refs of a chunk in [first, last) are the triangles overlapping a tile
+  struct TileRun {
+    std::uint32_t chunk;
+    std::uint32_t first;
+    std::uint32_t last;
+  };
+
+  // The textures of a mesh's material
+  struct MaterialTextures {
+    const Texture* diffuse;
+    const Texture* normal;
+    const Texture* metallic_roughness;
+    const Texture* emissive;
+  };
+
+  static constexpr auto chunk_size = std::size_t{256}; // triangles
+  static constexpr auto tile_size = 64; // pixels, a multiple of the 2x2 quads
+  static constexpr auto max_history_age = 16; // frames a color is reused at most
+  static constexpr auto history_tolerance = 0.01f; // relative difference of view depths
+  static constexpr auto max_checkerboard_age = 2; // frames a color is reused at most with checkerboard rendering
+  static constexpr auto reconstruction_tolerance = 0.05f; // relative difference of view depths
+  static constexpr auto unshaded_age = std::uint8_t{255}; // of pixels left to reconstruct
+
   int m_width;
   int m_height;
+  RenderMode m_mode;
+  bool m_depth_prepass;
+  bool m_sort_front_to_back;
+  bool m_multisample;
+  bool m_temporal_reuse;
+  bool m_checkerboard;
+  unsigned m_checkerboard_parity; // of the quads shaded in the last checkerboard frame
+  bool m_history_valid; // the previous buffers hold the last frame, rendered the same way
+  bool m_up_to_date; // no setting changed since the last frame
+  std::uint64_t m_model_version; // of the last frame, see Model::version
+  Mat4f m_previous_view_projection;
+  ShadingRateSource m_shading_rate_source;
+  Vec2f m_foveation_center; // in [0, 1] of the screen
+  ShadingRateImage m_shading_rates; // for the next visibility resolve
+  OcclusionBuffer m_occlusion;
+  std::vector<std::uint32_t> m_occluders; // mesh indices
+  std::vector<bool> m_visible_meshes; // of the last frame, per mesh
   std::vector<std::uint32_t> m_colorbuffer; // RGBA
+  std::vector<float> m_depthbuffer; // 0 at the near plane, 1 at the far plane
+  std::vector<GBufferTexel> m_gbuffer; // deferred mode only
+  std::vector<std::uint32_t> m_visibility; // visibility mode only, see pack_visibility
+  std::vector<float> m_sample_depths; // multisampling only, 4 per pixel, see sample_index
+  std::vector<std::uint32_t> m_sample_colors; // like m_sample_depths, used by the uncompressed pixels only
+  std::vector<std::uint8_t> m_uncompressed; // multisampling only, per pixel
+  std::vector<std::uint32_t> m_previous_colors; // temporal reuse only, of the last frame
+  std::vector<float> m_previous_depths;
+  std::vector<std::uint8_t> m_history_ages; // frames since each pixel was shaded
+  std::vector<std::uint8_t> m_previous_ages;
+  std::vector<std::uint8_t> m_reshade; // per pixel, to shade in this frame
+  unsigned m_triangle_bits; // of the visibility buffer ids
+  std::vector<Light> m_lights;
+  Vec3f m_ambient;
+  Sampler m_sampler;
+  std::vector<Chunk> m_chunks; // kept between frames to reuse their memory
+  std::vector<std::uint32_t> m_tile_offsets; // per tile, of its first run, and the run count last
+  std::vector<TileRun> m_tile_runs; // grouped by tile, in the draw order of the chunks
+  std::vector<std::uint16_t> m_sort_keys; // per chunk
+  std::vector<std::uint32_t> m_draw_order; // of the chunks
+  std::vector<std::uint32_t> m_sort_scratch;
+  std::vector<MaterialTextures> m_textures; // per mesh
+  std::vector<RenderStats> m_tile_stats;
+  RenderStats m_stats;
+
+  // Groups the runs of the chunks by tile, keeping the draw order within each tile
+  auto bin_chunks(std::size_t tile_count) -> void {
+    m_tile_offsets.assign(tile_count + 1, 0);
+    auto for_each_run = [&](const Chunk& chunk, auto&& f) {
+      for (auto first = std::size_t{0}; first < chunk.refs.size();) {
+        auto tile = chunk.refs[first] >> 32;
+        auto last = first + 1;
+        while (last < chunk.refs.size() && chunk.refs[last] >> 32 == tile) ++last;
+        f((std::size_t)tile, (std::uint32_t)first, (std::uint32_t)last);
+        first = last;
+      }
+    };
+    for (const auto& chunk : m_chunks)
+      for_each_run(chunk, [&](std::size_t tile, std::uint32_t, std::uint32_t) { ++m_tile_offsets[tile + 1]; });
+    for (auto tile = 0u; tile < tile_count; ++tile)
+      m_tile_offsets[tile + 1] += m_tile_offsets[tile];
+
+    // the offsets are the cursors of the tiles, which end up at the start of the next one
+    m_tile_runs.resize(m_tile_offsets.back());
+    for (auto c : m_draw_order) {
+      for_each_run(m_chunks[c], [&](std::size_t tile, std::uint32_t first, std::uint32_t last) {
+        m_tile_runs[m_tile_offsets[tile]++] = {c, first, last};
+      });
+    }
+    std::shift_right(m_tile_offsets.begin(), m_tile_offsets.end(), 1);
+    m_tile_offsets[0] = 0;
+  }
+
+  auto tile_runs(std::size_t tile) const -> std::span<const TileRun> {
+    return std::span{m_tile_runs}.subspan(m_tile_offsets[tile], m_tile_offsets[tile + 1] - m_tile_offsets[tile]);
+  }
+
+  // Draws the occluders into the occlusion buffer and marks the meshes hidden behind
+  // them, or outside the screen, as not visible. The occluders themselves are always
+  // visible. Returns the number of meshes skipped for each reason and the time taken
+  // by the occluders.
+  auto cull_occluded(const std::vector<Mesh>& meshes, const Mat4f& view_projection) -> RenderStats {
+    auto stats = RenderStats{};
+    m_visible_meshes.assign(meshes.size(), true);
+    if (m_occluders.empty()) return stats;
+
+    auto timer = Timer{};
+    m_occlusion.clear();
+    for (auto m : m_occluders) {
+      if (m < meshes.size()) m_occlusion.add_occluder(meshes[m].vertices, view_projection);
+    }
+    stats.occluder_time = timer.elapsed();
+
+    auto occluder = std::vector<bool>(meshes.size(), false);
+    for (auto m : m_occluders) {
+      if (m < meshes.size()) occluder[m] = true;
+    }
+    for (auto m = 0u; m < meshes.size(); ++m) {
+      if (occluder[m] || meshes[m].bounds.empty()) continue;
+      switch (m_occlusion.classify(meshes[m].bounds, view_projection)) {
+        case BoxVisibility::visible: break;
+        case BoxVisibility::off_screen: m_visible_meshes[m] = false; ++stats.off_screen_meshes; break;
+        case BoxVisibility::occluded: m_visible_meshes[m] = false; ++stats.culled_meshes; break;
+      }
+    }
+    return stats;
+  }
+
+  auto tile_rect(std::size_t tile, int tiles_x) const -> Rect {
+    auto tx = (int)(tile % (std::size_t)tiles_x);
+    auto ty = (int)(tile / (std::size_t)tiles_x);
+    return {tx * tile_size, ty * tile_size, std::min((tx + 1) * tile_size, m_width), std::min((ty + 1) * tile_size, m_height)};
+  }
+
+  auto clear(const Rect& rect) -> void {
+    for (auto y = rect.min_y; y < rect.max_y; ++y) {
+      auto row = (std::ptrdiff_t)(y * m_width);
+      std::fill(m_colorbuffer.begin() + row + rect.min_x, m_colorbuffer.begin() + row + rect.max_x, 0);
+      std::fill(m_depthbuffer.begin() + row + rect.min_x, m_depthbuffer.begin() + row + rect.max_x, 1.0f);
+    }
+  }
+
+  auto covered_pixels(const Rect& rect) const -> std::size_t {
+    auto count = std::size_t{0};
+    for (auto y = rect.min_y; y < rect.max_y; ++y) {
+      auto row = (std::ptrdiff_t)(y * m_width);
+      count += (std::size_t)std::count_if(m_depthbuffer.begin() + row + rect.min_x, m_depthbuffer.begin() + row + rect.max_x, [](float depth) { return depth < 1.0f; });
+    }
+    return count;
+  }
+
+  // Index of each lane's pixel; lanes off the screen must be masked out
+  auto lane_indices(int x, int y) const -> std::array<std::size_t, 4> {
+    auto index = (std::size_t)(y * m_width + x);
+    return {index, index + 1, index + (std::size_t)m_width, index + (std::size_t)m_width + 1};
+  }
+
+  // Temporal reuse over a rect, after the depth prepass. A covered pixel keeps the
+  // previous color at its reprojected position when the view depth stored there is
+  // within history_tolerance of its own. The other covered pixels are marked in
+  // m_reshade.
+  /// @param reprojection from the current normalized device coordinates to the previous clip space
+  auto reproject(const Rect& rect, const Mat4f& inverse_view_projection, const Mat4f& reprojection, const Mat4f& previous_inverse, RenderStats& stats) -> void {
+    for (auto y = rect.min_y; y < rect.max_y; ++y) {
+      for (auto x = rect.min_x; x < rect.max_x; ++x) {
+        auto pixel = (std::size_t)(y * m_width + x);
+        auto depth = m_depthbuffer[pixel];
+        m_reshade[pixel] = 0;
+        if (depth >= 1.0f) continue;
+
+        if (auto previous = m_history_valid ? find_in_history(x, y, depth, inverse_view_projection, reprojection, previous_inverse) : std::nullopt) {
+          auto age = m_previous_ages[*previous];
+          if (age + 1 < max_history_age) {
+            m_colorbuffer[pixel] = m_previous_colors[*previous];
+            m_history_ages[pixel] = (std::uint8_t)(age + 1);
+            ++stats.reused;
+            continue;
+          }
+        }
+        m_reshade[pixel] = 1;
+        // staggered by a hash of the pixel, so the pixels shaded together are not all
+        // reshaded together
+        auto hash = (std::uint32_t)x * 0x9e3779b1u ^ (std::uint32_t)y * 0x85ebca77u;
+        m_history_ages[pixel] = (std::uint8_t)((hash ^ hash >> 15) % (max_history_age / 2));
+        ++stats.reshaded;
+      }
+    }
+  }
+
+  // Checkerboard rendering over a rect, after the depth prepass. The covered pixels of
+  // the quads whose turn it is are marked in m_reshade. The others keep the previous
+  // color at their reprojected position as in reproject, or are marked with
+  // unshaded_age for reconstruct.
+  auto reproject_checkerboard(const Rect& rect, const Mat4f& inverse_view_projection, const Mat4f& reprojection, const Mat4f& previous_inverse, RenderStats& stats) -> void {
+    for (auto y = rect.min_y; y < rect.max_y; ++y) {
+      for (auto x = rect.min_x; x < rect.max_x; ++x) {
+        auto pixel = (std::size_t)(y * m_width + x);
+        auto depth = m_depthbuffer[pixel];
+        m_reshade[pixel] = 0;
+        if (depth >= 1.0f) continue;
+
+        if ((unsigned)(x / 2 + y / 2) % 2 == m_checkerboard_parity) {
+          m_reshade[pixel] = 1;
+          m_history_ages[pixel] = 0;
+          continue;
+        }
+        if (auto previous = m_history_valid ? find_in_history(x, y, depth, inverse_view_projection, reprojection, previous_inverse) : std::nullopt) {
+          auto age = m_previous_ages[*previous];
+          if (age + 1 < max_checkerboard_age) {
+            m_colorbuffer[pixel] = m_previous_colors[*previous];
+            m_history_ages[pixel] = (std::uint8_t)(age + 1);
+            ++stats.reused;
+            continue;
+          }
+        }
+        m_history_ages[pixel] = unshaded_age;
+      }
+    }
+  }
+
+  // Fills the pixels of a rect left by reproject_checkerboard with the average of the
+  // shaded pixels on their row and column, the nearest ones weighted double. Both
+  // quads next to a quad are shaded, so these are 1 and 2 pixels away. Pixels of other
+  // surfaces are left out, and a pixel without any on its surface takes the nearest
+  // depth among them. Returns the number of pixels filled.
+  auto reconstruct(const Rect& rect, const Mat4f& inverse_view_projection) -> std::size_t {
+    auto filled = std::size_t{0};
+    for (auto y = rect.min_y; y < rect.max_y; ++y) {
+      for (auto x = rect.min_x; x < rect.max_x; ++x) {
+        auto pixel = (std::size_t)(y * m_width + x);
+        if (m_depthbuffer[pixel] >= 1.0f || m_history_ages[pixel] != unshaded_age) continue;
+
+        auto w = clip_w(pixel_ndc(x, y, m_depthbuffer[pixel]), inverse_view_projection);
+        auto out_x = x % 2 == 0 ? -1 : 1; // toward the quad next to this pixel
+        auto out_y = y % 2 == 0 ? -1 : 1;
+        auto neighbours = std::array<std::array<int, 3>, 4>{{ // x, y, weight
+          {x + out_x, y, 2}, {x - 2 * out_x, y, 1}, {x, y + out_y, 2}, {x, y - 2 * out_y, 1}
+        }};
+
+        auto sum = std::array<float, 3>{};
+        auto weights = 0.0f;
+        auto nearest = std::optional<std::size_t>{};
+        auto nearest_difference = std::numeric_limits<float>::max();
+        for (auto [nx, ny, weight] : neighbours) {
+          if (nx < 0 || nx >= m_width || ny < 0 || ny >= m_height) continue;
+          auto neighbour = (std::size_t)(ny * m_width + nx);
+          auto depth = m_depthbuffer[neighbour];
+          if (depth >= 1.0f) continue;
+
+          auto difference = std::abs(clip_w(pixel_ndc(nx, ny, depth), inverse_view_projection) - w);
+          if (difference < nearest_difference) {
+            nearest = neighbour;
+            nearest_difference = difference;
+          }
+          if (difference > reconstruction_tolerance * w) continue;
+          auto color = m_colorbuffer[neighbour];
+          for (auto channel = 0u; channel < 3; ++channel)
+            sum[channel] += srgb_decode_table[color >> (24 - 8 * channel) & 0xffu] * (float)weight;
+          weights += (float)weight;
+        }
+
+        if (weights > 0.0f) {
+          m_colorbuffer[pixel] = (std::uint32_t)encode_srgb(sum[0] / weights) << 24 |
+                                 (std::uint32_t)encode_srgb(sum[1] / weights) << 16 |
+                                 (std::uint32_t)encode_srgb(sum[2] / weights) << 8 |
+                                 255u;
+        }
+        else if (nearest) {
+          m_colorbuffer[pixel] = m_colorbuffer[*nearest];
+        }
+        ++filled;
+      }
+    }
+    return filled;
+  }
+
+  // Normalized device coordinates of the center of pixel (x, y) at depth
+  auto pixel_ndc(int x, int y, float depth) const -> Vec4f {
+    return {
+      ((float)x + 0.5f) * 2.0f / (float)m_width - 1.0f,
+      1.0f - ((float)y + 0.5f) * 2.0f / (float)m_height,
+      depth * 2.0f - 1.0f,
+      1.0f
+    };
+  }
+
+  // Clip space w of the point at ndc, the distance along the view direction
+  static auto clip_w(const Vec4f& ndc, const Mat4f& inverse_view_projection) -> float {
+    const auto& m = inverse_view_projection;
+    return 1.0f / (ndc.x * m[0][3] + ndc.y * m[1][3] + ndc.z * m[2][3] + m[3][3]);
+  }
+
+  // Index of the pixel of the previous frame showing the surface at pixel (x, y) and
+  // depth, if any
+  auto find_in_history(int x, int y, float depth, const Mat4f& inverse_view_projection, const Mat4f& reprojection, const Mat4f& previous_inverse) const -> std::optional<std::size_t> {
+    auto ndc = pixel_ndc(x, y, depth);
+    auto clip = ndc * reprojection; // divided by the current w
+    if (clip.w <= 0.0f) return std::nullopt;
+    auto px = (clip.x / clip.w * 0.5f + 0.5f) * (float)m_width;
+    auto py = (0.5f - clip.y / clip.w * 0.5f) * (float)m_height;
+    if (!(px >= 0.0f && px < (float)m_width && py >= 0.0f && py < (float)m_height)) return std::nullopt;
+
+    auto previous_x = (int)px;
+    auto previous_y = (int)py;
+    auto previous = (std::size_t)(previous_y * m_width + previous_x);
+    auto previous_depth = m_previous_depths[previous];
+    if (previous_depth >= 1.0f) return std::nullopt;
+
+    auto w = clip.w * clip_w(ndc, inverse_view_projection);
+    auto stored_w = clip_w(pixel_ndc(previous_x, previous_y, previous_depth), previous_inverse);
+    if (std::abs(stored_w - w) > history_tolerance * w) return std::nullopt;
+    return previous;
+  }
+
+  // Lanes of the quad left to shade after reprojection, as a mask
+  auto reshade_mask(const Quad& quad) const -> Float4 {
+    auto indices = lane_indices(quad.x, quad.y);
+    auto covered = mask_bits(quad.mask);
+    auto lanes = std::array<float, 4>{};
+    for (auto lane = 0u; lane < 4; ++lane) {
+      if (covered & 1u << lane && m_reshade[indices[lane]]) lanes[lane] = 1.0f;
+    }
+    return Float4::load(lanes.data()) > Float4{0.0f};
+  }
+
+  // Lanes of the quad in front of the depth buffer, or exactly at its depth, as bits
+  auto depth_test(const Quad& quad, const std::array<std::size_t, 4>& indices, bool equal = false) const -> unsigned {
+    auto covered = mask_bits(quad.mask);
+    auto stored = std::array<float, 4>{1.0f, 1.0f, 1.0f, 1.0f};
+    for (auto lane = 0u; lane < 4; ++lane) {
+      if (covered & 1u << lane) stored[lane] = m_depthbuffer[indices[lane]];
+    }
+    auto depth = Float4::load(stored.data());
+    return mask_bits(quad.mask & (equal ? quad.depth == depth : quad.depth < depth));
+  }
+
+  // Uvs of the quad's pixels. Lanes outside the triangle still get extrapolated uvs,
+  // so the derivatives are valid at its edges.
+  static auto quad_uvs(const Quad& quad, const RasterTriangle& triangle) -> std::array<Vec2f, 4> {
+    const auto& v = triangle.vertices;
+    const auto& w = quad.weights;
+    auto u = std::array<float, 4>{};
+    auto t = std::array<float, 4>{};
+    (w[0] * Float4{v[0].uv.x} + w[1] * Float4{v[1].uv.x} + w[2] * Float4{v[2].uv.x}).store(u.data());
+    (w[0] * Float4{v[0].uv.y} + w[1] * Float4{v[1].uv.y} + w[2] * Float4{v[2].uv.y}).store(t.data());
+    return {Vec2f{u[0], t[0]}, Vec2f{u[1], t[1]}, Vec2f{u[2], t[2]}, Vec2f{u[3], t[3]}};
+  }
+
+  // Color of the quad's pixels in the texture
+  auto sample(const Texture& texture, const std::array<Vec2f, 4>& uvs) const -> Vec3x4 {
+    auto texels = texture.sample_quad(uvs, m_sampler);
+    return {
+      Float4{texels[0].r, texels[1].r, texels[2].r, texels[3].r},
+      Float4{texels[0].g, texels[1].g, texels[2].g, texels[3].g},
+      Float4{texels[0].b, texels[1].b, texels[2].b, texels[3].b}
+    };
+  }
+
+  // The interpolated normal, perturbed by the normal map if there is one
+  auto surface_normal(const Quad& quad, const RasterTriangle& triangle, const Texture* normal_map, const std::array<Vec2f, 4>& uvs) const -> Vec3x4 {
+    const auto& v = triangle.vertices;
+    const auto& w = quad.weights;
+    auto normal = Vec3x4{v[0].normal} * w[0] + Vec3x4{v[1].normal} * w[1] + Vec3x4{v[2].normal} * w[2];
+    if (!normal_map) return normal;
+
+    auto tangent_of = [](const Vertex& vertex) { return Vec3x4{Vec3f{vertex.tangent.x, vertex.tangent.y, vertex.tangent.z}}; };
+    auto n = normalize(normal);
+    auto t = tangent_of(v[0]) * w[0] + tangent_of(v[1]) * w[1] + tangent_of(v[2]) * w[2];
+    t = normalize(t - n * dot(n, t));
+    auto b = cross(n, t) * Float4{v[0].tangent.w < 0.0f ? -1.0f : 1.0f};
+
+    auto one = Float4{1.0f};
+    auto two = Float4{2.0f};
+    auto texel = sample(*normal_map, uvs);
+    return t * (texel.x * two - one) + b * (texel.y * two - one) + n * (texel.z * two - one);
+  }
+
+  // Lit color of four pixels of a material
+  auto light(const Material& material, const MaterialTextures& textures, const std::array<Vec2f, 4>& uvs, const Vec3f& eye, const Vec3x4& position, const Vec3x4& normal) const -> Vec3x4 {
+    auto diffuse = Vec3x4{material.diffuse};
+    if (textures.diffuse) diffuse = diffuse * sample(*textures.diffuse, uvs);
+
+    auto color = Vec3x4{};
+    if (material.pbr) {
+      // the map scales the metallic and roughness factors, as in glTF
+      auto surface = PbrSurface{diffuse, Float4{material.metallic}, Float4{material.roughness}};
+      if (textures.metallic_roughness) {
+        auto texel = sample(*textures.metallic_roughness, uvs);
+        surface.roughness = surface.roughness * texel.y;
+        surface.metallic = surface.metallic * texel.z;
+      }
+      color = physically_based(surface, material.ambient, m_lights, m_ambient, eye, position, normal);
+    }
+    else {
+      color = blinn_phong(material, diffuse, m_lights, m_ambient, eye, position, normal);
+    }
+
+    // converters from glTF write Ke as the factor of the emissive map even without one.
+    // A named map that is not loaded yet emits nothing rather than the bare factor.
+    if (textures.emissive)
+      color += Vec3x4{material.emission} * sample(*textures.emissive, uvs);
+    else if (!material.pbr && !material.emissive_texture)
+      color += Vec3x4{material.emission};
+    return color;
+  }
+
+  // Linear colors of the lanes clamped to [0, 1], encoded as sRGB and packed as RGBA
+  static auto pack_colors(const Vec3x4& color) -> std::array<std::uint32_t, 4> {
+    auto one = Float4{1.0f};
+    auto zero = Float4{0.0f};
+    auto r = std::array<float, 4>{};
+    auto g = std::array<float, 4>{};
+    auto b = std::array<float, 4>{};
+    min(max(color.x, zero), one).store(r.data());
+    min(max(color.y, zero), one).store(g.data());
+    min(max(color.z, zero), one).store(b.data());
+
+    auto packed = std::array<std::uint32_t, 4>{};
+    for (auto lane = 0u; lane < 4; ++lane) {
+      packed[lane] = (std::uint32_t)encode_srgb(r[lane]) << 24 |
+                     (std::uint32_t)encode_srgb(g[lane]) << 16 |
+                     (std::uint32_t)encode_srgb(b[lane]) << 8 |
+                     255u;
+    }
+    return packed;
+  }
+
+  auto write_color(const std::array<std::size_t, 4>& indices, unsigned lanes, const Vec3x4& color) -> void {
+    auto packed = pack_colors(color);
+    for (auto lane = 0u; lane < 4; ++lane) {
+      if (lanes & 1u << lane) m_colorbuffer[indices[lane]] = packed[lane];
+    }
+  }
+
+  auto write_depth(const Quad& quad, const std::array<std::size_t, 4>& indices, unsigned lanes) -> void {
+    auto depth = std::array<float, 4>{};
+    quad.depth.store(depth.data());
+    for (auto lane = 0u; lane < 4; ++lane) {
+      if (lanes & 1u << lane) m_depthbuffer[indices[lane]] = depth[lane];
+    }
+  }
+
+  // Forward shading; returns the lanes that passed the depth test. After a depth
+  // prepass only the lanes at exactly the stored depth pass and the depth is kept.
+  // Coplanar triangles at the same depth are then both shaded, the last one wins.
+  auto shade(const Quad& quad, const RasterTriangle& triangle, const Material& material, const MaterialTextures& textures, const Vec3f& eye, bool after_prepass) -> unsigned {
+    auto indices = lane_indices(quad.x, quad.y);
+    auto visible = depth_test(quad, indices, after_prepass);
+    if (visible == 0) return 0;
+
+    auto color = surface_color(quad, triangle, material, textures, eye);
+    if (!after_prepass) write_depth(quad, indices, visible);
+    write_color(indices, visible, color);
+    return visible;
+  }
+
+  // Lit color of the quad's pixels
+  auto surface_color(const Quad& quad, const RasterTriangle& triangle, const Material& material, const MaterialTextures& textures, const Vec3f& eye) const -> Vec3x4 {
+    const auto& v = triangle.vertices;
+    const auto& w = quad.weights;
+    auto position = Vec3x4{v[0].position} * w[0] + Vec3x4{v[1].position} * w[1] + Vec3x4{v[2].position} * w[2];
+    auto uvs = quad_uvs(quad, triangle);
+    auto normal = surface_normal(quad, triangle, textures.normal, uvs);
+    return light(material, textures, uvs, eye, position, normal);
+  }
+
+  // Multisampled forward shading, once per pixel; returns the lanes with a sample that
+  // passed the depth test. After a depth prepass the samples at exactly the stored
+  // depth pass, as in shade.
+  auto shade_multisample(const MultisampleQuad& quad, const RasterTriangle& triangle, const Material& material, const MaterialTextures& textures, const Vec3f& eye, bool after_prepass) -> unsigned {
+    auto indices = lane_indices(quad.pixels.x, quad.pixels.y);
+    auto samples = sample_depth_test(quad, after_prepass);
+    if (samples == 0) return 0;
+
+    auto color = surface_color(quad.pixels, triangle, material, textures, eye);
+    if (!after_prepass) write_sample_depths(quad);
+    write_sample_colors(quad.pixels.x, quad.pixels.y, indices, samples, color);
+    return sample_lanes(samples);
+  }
+
+  // Index of the first sample of the quad whose top left pixel is (x, y). The samples
+  // of a quad are stored sample by sample, each as its 4 lanes, so they load as Float4.
+  auto sample_index(int x, int y) const -> std::size_t {
+    return ((std::size_t)(y / 2) * (std::size_t)((m_width + 1) / 2) + (std::size_t)(x / 2)) * 16;
+  }
+
+  auto sample_count() const -> std::size_t {
+    return (std::size_t)((m_width + 1) / 2) * (std::size_t)((m_height + 1) / 2) * 16;
+  }
+
+  /// @param rect must start at even coordinates
+  auto clear_samples(const Rect& rect) -> void {
+    for (auto y = rect.min_y; y < rect.max_y; y += 2)
+      std::fill(m_sample_depths.begin() + (std::ptrdiff_t)sample_index(rect.min_x, y), m_sample_depths.begin() + (std::ptrdiff_t)sample_index(rect.max_x + 1, y), 1.0f);
+    for (auto y = rect.min_y; y < rect.max_y; ++y) {
+      auto row = (std::ptrdiff_t)(y * m_width);
+      std::fill(m_uncompressed.begin() + row + rect.min_x, m_uncompressed.begin() + row + rect.max_x, std::uint8_t{0});
+    }
+  }
+
+  // Samples of the quad in front of the stored ones, or exactly at their depth, as the
+  // bits lane * 4 + sample
+  auto sample_depth_test(const MultisampleQuad& quad, bool equal = false) const -> unsigned {
+    const auto* stored = &m_sample_depths[sample_index(quad.pixels.x, quad.pixels.y)];
+    auto passed = 0u;
+    for (auto sample = 0u; sample < 4; ++sample) {
+      auto depth = Float4::load(stored + sample * 4);
+      const auto& quad_depth = quad.depths[sample];
+      auto lanes = mask_bits(quad.masks[sample] & (equal ? quad_depth == depth : quad_depth < depth));
+      for (auto lane = 0u; lane < 4; ++lane) {
+        if (lanes & 1u << lane) passed |= 1u << (lane * 4 + sample);
+      }
+    }
+    return passed;
+  }
+
+  // Lanes with any of the samples, as bits
+  static auto sample_lanes(unsigned samples) -> unsigned {
+    auto lanes = 0u;
+    for (auto lane = 0u; lane < 4; ++lane) {
+      if (samples >> lane * 4 & 0xfu) lanes |= 1u << lane;
+    }
+    return lanes;
+  }
+
+  // Stores the depth of the covered samples in front of the stored ones, the samples
+  // that passed sample_depth_test
+  auto write_sample_depths(const MultisampleQuad& quad) -> void {
+    auto* stored = &m_sample_depths[sample_index(quad.pixels.x, quad.pixels.y)];
+    for (auto sample = 0u; sample < 4; ++sample) {
+      auto depth = Float4::load(stored + sample * 4);
+      const auto& quad_depth = quad.depths[sample];
+      select(quad.masks[sample] & (quad_depth < depth), quad_depth, depth).store(stored + sample * 4);
+    }
+  }
+
+  // A pixel whose samples are all written stays or becomes compressed, with its color
+  // in the colorbuffer. Otherwise its color is first copied to every sample.
+  auto write_sample_colors(int x, int y, const std::array<std::size_t, 4>& indices, unsigned samples, const Vec3x4& color) -> void {
+    auto packed = pack_colors(color);
+    auto* colors = &m_sample_colors[sample_index(x, y)];
+    for (auto lane = 0u; lane < 4; ++lane) {
+      auto written = samples >> lane * 4 & 0xfu;
+      if (written == 0) continue;
+      auto pixel = indices[lane];
+      if (written == 0xfu) {
+        m_colorbuffer[pixel] = packed[lane];
+        m_uncompressed[pixel] = 0;
+        continue;
+      }
+      if (!m_uncompressed[pixel]) {
+        for (auto sample = 0u; sample < 4; ++sample)
+          colors[sample * 4 + lane] = m_colorbuffer[pixel];
+        m_uncompressed[pixel] = 1;
+      }
+      for (auto sample = 0u; sample < 4; ++sample) {
+        if (written & 1u << sample) colors[sample * 4 + lane] = packed[lane];
+      }
+    }
+  }
+
+  // Averages the samples of the uncompressed pixels into the colorbuffer and keeps the
+  // nearest sample depth of every pixel in the depth buffer
+  /// @param rect must start at even coordinates
+  auto resolve(const Rect& rect) -> void {
+    for (auto y = rect.min_y; y < rect.max_y; y += 2) {
+      for (auto x = rect.min_x; x < rect.max_x; x += 2) {
+        auto first = sample_index(x, y);
+        const auto* depths = &m_sample_depths[first];
+        auto nearest = std::array<float, 4>{};
+        min(min(Float4::load(depths), Float4::load(depths + 4)), min(Float4::load(depths + 8), Float4::load(depths + 12))).store(nearest.data());
+
+        for (auto lane = 0u; lane < 4; ++lane) {
+          auto px = x + (int)(lane % 2);
+          auto py = y + (int)(lane / 2);
+          if (px >= rect.max_x || py >= rect.max_y) continue;
+          auto pixel = (std::size_t)(py * m_width + px);
+          m_depthbuffer[pixel] = nearest[lane];
+          if (!m_uncompressed[pixel]) continue;
+
+          // colors are averaged in linear space, alpha as stored
+          const auto* colors = &m_sample_colors[first + lane];
+          auto alpha = 2u;
+          for (auto sample = 0u; sample < 4; ++sample)
+            alpha += colors[sample * 4] & 0xffu;
+          auto resolved = alpha / 4;
+          for (auto shift = 8u; shift < 32; shift += 8) {
+            auto sum = 0.0f;
+            for (auto sample = 0u; sample < 4; ++sample)
+              sum += srgb_decode_table[colors[sample * 4] >> shift & 0xffu];
+            resolved |= (std::uint32_t)encode_srgb(sum * 0.25f) << shift;
+          }
+          m_colorbuffer[pixel] = resolved;
+        }
+      }
+    }
+  }
+
+  // Geometry pass of deferred shading; returns the lanes that passed the depth test.
+  // Normal maps are applied here, so the G-buffer needs no tangent frame.
+  auto write_gbuffer(const Quad& quad, const RasterTriangle& triangle, const MaterialTextures& textures) -> unsigned {
+    auto indices = lane_indices(quad.x, quad.y);
+    auto visible = depth_test(quad, indices);
+    if (visible == 0) return 0;
+
+    auto uvs = quad_uvs(quad, triangle);
+    auto normal = surface_normal(quad, triangle, textures.normal, uvs);
+    auto nx = std::array<float, 4>{};
+    auto ny = std::array<float, 4>{};
+    auto nz = std::array<float, 4>{};
+    normal.x.store(nx.data());
+    normal.y.store(ny.data());
+    normal.z.store(nz.data());
+
+    write_depth(quad, indices, visible);
+    for (auto lane = 0u; lane < 4; ++lane) {
+      if (!(visible & 1u << lane)) continue;
+      auto n = Vec3f{nx[lane], ny[lane], nz[lane]};
+      m_gbuffer[indices[lane]] = {encode_octahedral(n), triangle.mesh, uvs[lane]};
+    }
+    return visible;
+  }
+
+  // Lighting pass of deferred shading over a rect; returns the number of pixels shaded.
+  // Positions are reconstructed from the depth buffer. The lanes of a quad are shaded
+  // together per material; lanes of other materials take the uv of a shaded lane, so
+  // texture filtering only sees the derivatives within the material.
+  auto shade_gbuffer(const Rect& rect, const std::vector<Mesh>& meshes, const Mat4f& inverse_view_projection, const Vec3f& eye) -> std::size_t {
+    const auto& m = inverse_view_projection;
+    auto shaded = std::size_t{0};
+    auto lane_x = Float4{0.5f, 1.5f, 0.5f, 1.5f};
+    auto lane_y = Float4{0.5f, 0.5f, 1.5f, 1.5f};
+
+    for (auto y = rect.min_y; y < rect.max_y; y += 2) {
+      for (auto x = rect.min_x; x < rect.max_x; x += 2) {
+        auto indices = lane_indices(x, y);
+        auto on_screen = 1u | (x + 1 < m_width ? 2u : 0u);
+        if (y + 1 < m_height) on_screen |= on_screen << 2;
+
+        // the G-buffer is not cleared; pixels at the far plane were not drawn to
+        auto texels = std::array<GBufferTexel, 4>{};
+        auto depth = std::array<float, 4>{1.0f, 1.0f, 1.0f, 1.0f};
+        auto pending = 0u;
+        for (auto lane = 0u; lane < 4; ++lane) {
+          if (!(on_screen & 1u << lane) || m_depthbuffer[indices[lane]] == 1.0f) continue;
+          texels[lane] = m_gbuffer[indices[lane]];
+          depth[lane] = m_depthbuffer[indices[lane]];
+          pending |= 1u << lane;
+        }
+        if (pending == 0) continue;
+
+        // normalized device coordinates back to world space
+        auto ndc_x = (Float4{(float)x} + lane_x) * Float4{2.0f / (float)m_width} - Float4{1.0f};
+        auto ndc_y = Float4{1.0f} - (Float4{(float)y} + lane_y) * Float4{2.0f / (float)m_height};
+        auto ndc_z = Float4::load(depth.data()) * Float4{2.0f} - Float4{1.0f};
+        auto column = [&](unsigned j) { return ndc_x * Float4{m[0][j]} + ndc_y * Float4{m[1][j]} + ndc_z * Float4{m[2][j]} + Float4{m[3][j]}; };
+        auto inv_w = Float4{1.0f} / column(3);
+        auto position = Vec3x4{column(0) * inv_w, column(1) * inv_w, column(2) * inv_w};
+
+        std::array<Vec3f, 4> normals;
+        for (auto lane = 0u; lane < 4; ++lane)
+          normals[lane] = decode_octahedral(texels[lane].normal);
+        auto normal = Vec3x4{
+          Float4{normals[0].x, normals[1].x, normals[2].x, normals[3].x},
+          Float4{normals[0].y, normals[1].y, normals[2].y, normals[3].y},
+          Float4{normals[0].z, normals[1].z, normals[2].z, normals[3].z}
+        };
+
+        while (pending != 0) {
+          auto material = texels[(unsigned)std::countr_zero(pending)].material;
+          auto lanes = 0u;
+          for (auto lane = 0u; lane < 4; ++lane) {
+            if ((pending & 1u << lane) && texels[lane].material == material) lanes |= 1u << lane;
+          }
+          pending &= ~lanes;
+
+          std::array<Vec2f, 4> uvs;
+          for (auto lane = 0u; lane < 4; ++lane)
+            uvs[lane] = texels[lanes & 1u << lane ? lane : (unsigned)std::countr_zero(lanes)].uv;
+
+          auto color = light(meshes[material].material, m_textures[material], uvs, eye, position, normal);
+          write_color(indices, lanes, color);
+          shaded += (std::size_t)std::popcount(lanes);
+        }
+      }
+    }
+    return shaded;
+  }
+
+  // Splits the 32 bits of the visibility buffer ids between the mesh index and the
+  // triangle index, with as many bits for the triangles as the mesh count allows
+  auto set_visibility_packing(const std::vector<Mesh>& meshes) -> void {
+    auto mesh_bits = meshes.empty() ? 0u : (unsigned)std::bit_width(meshes.size() - 1);
+    m_triangle_bits = 32 - mesh_bits;
+    for (const auto& mesh : meshes) {
+      if (m_triangle_bits < 32 && mesh.vertices.size() / 3 > std::size_t{1} << m_triangle_bits)
+        throw std::runtime_error{"Too many triangles in a mesh for the visibility buffer"};
+    }
+  }
+
+  auto pack_visibility(std::uint32_t mesh, std::uint32_t triangle) const -> std::uint32_t {
+    return m_triangle_bits == 32 ? triangle : mesh << m_triangle_bits | triangle;
+  }
+
+  auto unpack_visibility(std::uint32_t id) const -> std::pair<std::uint32_t, std::uint32_t> {
+    if (m_triangle_bits == 32) return {0, id};
+    return {id >> m_triangle_bits, id & ((1u << m_triangle_bits) - 1)};
+  }
+
+  // Raster pass of the visibility mode; returns the lanes that passed the depth test
+  auto write_visibility(const Quad& quad, const RasterTriangle& triangle) -> unsigned {
+    auto indices = lane_indices(quad.x, quad.y);
+    auto visible = depth_test(quad, indices);
+    if (visible == 0) return 0;
+
+    write_depth(quad, indices, visible);
+    auto id = pack_visibility(triangle.mesh, triangle.index);
+    for (auto lane = 0u; lane < 4; ++lane) {
+      if (visible & 1u << lane) m_visibility[indices[lane]] = id;
+    }
+    return visible;
+  }
+
+  // Resolve pass of the visibility mode over a rect. Pixels are shaded in quads of 2x2
+  // coarse pixels, of 1, 2 or 4 pixels per side after the rate of their tile, with a
+  // lane per coarse pixel. The lanes showing a triangle are shaded together at the
+  // centers of their coarse pixels, and each color goes to the pixels of its coarse
+  // pixel showing that triangle. The triangle is transformed again and the
+  // perspective-correct barycentrics of all four lanes are solved from its clip space
+  // vertices, so lanes outside it extrapolate and the uv derivatives hold, at the
+  // spacing of the coarse pixels.
+  auto resolve_visibility(const Rect& rect, const std::vector<Mesh>& meshes, const Mat4f& view_projection, const Vec3f& eye, RenderStats& stats) -> void {
+    auto lane_x = Float4{0.5f, 1.5f, 0.5f, 1.5f};
+    auto lane_y = Float4{0.5f, 0.5f, 1.5f, 1.5f};
+    auto cached_id = std::optional<std::uint32_t>{};
+    auto triangle = RasterTriangle{{Vec4f{}, Vec4f{}, Vec4f{}}, {Vertex{}, Vertex{}, Vertex{}}, 0, 0, 0, 0, 0, 0};
+    std::array<Vec3f, 3> edges;
+
+    constexpr auto rate_tile = ShadingRateImage::tile_size;
+    for (auto tile_y = rect.min_y; tile_y < rect.max_y; tile_y += rate_tile) {
+      for (auto tile_x = rect.min_x; tile_x < rect.max_x; tile_x += rate_tile) {
+        auto rate = m_shading_rate_source == ShadingRateSource::none ? 1 : (int)m_shading_rates.rate(tile_x, tile_y);
+        auto size = rate * 2; // of a coarse quad, in pixels
+        auto max_y = std::min(tile_y + rate_tile, rect.max_y);
+        auto max_x = std::min(tile_x + rate_tile, rect.max_x);
+
+        for (auto y = tile_y; y < max_y; y += size) {
+          for (auto x = tile_x; x < max_x; x += size) {
+            // the visibility buffer is not cleared; pixels at the far plane were not drawn to
+            auto ids = std::array<std::uint32_t, 64>{}; // per pixel of the coarse quad, row by row
+            auto pending = std::uint64_t{0};
+            for (auto py = 0; py < size && y + py < m_height; ++py) {
+              for (auto px = 0; px < size && x + px < m_width; ++px) {
+                auto index = (std::size_t)((y + py) * m_width + x + px);
+                if (m_depthbuffer[index] == 1.0f) continue;
+                ids[(std::size_t)(py * size + px)] = m_visibility[index];
+                pending |= std::uint64_t{1} << (py * size + px);
+              }
+            }
+            if (pending == 0) continue;
+
+            auto scale = Float4{(float)rate};
+            auto ndc_x = (Float4{(float)x} + lane_x * scale) * Float4{2.0f / (float)m_width} - Float4{1.0f};
+            auto ndc_y = Float4{1.0f} - (Float4{(float)y} + lane_y * scale) * Float4{2.0f / (float)m_height};
+
+            while (pending != 0) {
+              auto id = ids[(std::size_t)std::countr_zero(pending)];
+              auto pixels = std::uint64_t{0};
+              auto lanes = 0u;
+              for (auto rest = pending; rest != 0; rest &= rest - 1) {
+                auto pixel = std::countr_zero(rest);
+                if (ids[(std::size_t)pixel] != id) continue;
+                pixels |= std::uint64_t{1} << pixel;
+                lanes |= 1u << ((pixel / size / rate) * 2 + pixel % size / rate);
+              }
+              pending &= ~pixels;
+
+              // neighbouring quads mostly show the same triangles
+              if (id != cached_id) {
+                auto [mesh, index] = unpack_visibility(id);
+                const auto* vertices = &meshes[mesh].vertices[(std::size_t)index * 3];
+                triangle = RasterTriangle{{Vec4f{}, Vec4f{}, Vec4f{}}, {vertices[0], vertices[1], vertices[2]}, mesh, index, 0, 0, 0, 0};
+                std::array<Vec3f, 3> clip; // x, y and w
+                for (auto v = 0u; v < 3; ++v) {
+                  auto position = Vec4f{vertices[v].position, 1.0f} * view_projection;
+                  clip[v] = Vec3f{position.x, position.y, position.w};
+                }
+                for (auto i = 0u; i < 3; ++i)
+                  edges[i] = cross(clip[(i + 1) % 3], clip[(i + 2) % 3]);
+                cached_id = id;
+              }
+
+              // weight i is proportional to the edge function of the edge opposite vertex i
+              // in homogeneous coordinates; normalizing them makes them perspective-correct
+              std::array<Float4, 3> e;
+              for (auto i = 0u; i < 3; ++i)
+                e[i] = Float4{edges[i].x} * ndc_x + Float4{edges[i].y} * ndc_y + Float4{edges[i].z};
+              auto inv_sum = Float4{1.0f} / (e[0] + e[1] + e[2]);
+              auto quad = Quad{x, y, Float4{}, Float4{}, {e[0] * inv_sum, e[1] * inv_sum, e[2] * inv_sum}};
+
+              auto mesh = triangle.mesh;
+              const auto& v = triangle.vertices;
+              const auto& w = quad.weights;
+              const auto& textures = m_textures[mesh];
+              auto position = Vec3x4{v[0].position} * w[0] + Vec3x4{v[1].position} * w[1] + Vec3x4{v[2].position} * w[2];
+              auto uvs = quad_uvs(quad, triangle);
+              auto normal = surface_normal(quad, triangle, textures.normal, uvs);
+              auto packed = pack_colors(light(meshes[mesh].material, textures, uvs, eye, position, normal));
+              for (auto rest = pixels; rest != 0; rest &= rest - 1) {
+                auto pixel = std::countr_zero(rest);
+                auto lane = (pixel / size / rate) * 2 + pixel % size / rate;
+                m_colorbuffer[(std::size_t)((y + pixel / size) * m_width + x + pixel % size)] = packed[(std::size_t)lane];
+              }
+              stats.shaded += (std::size_t)std::popcount(lanes);
+              stats.coarse_saved += (std::size_t)(std::popcount(pixels) - std::popcount(lanes));
+            }
+          }
+        }
+      }
+    }
+  }
 };
 
-#endif // RENDERER_HPP
\ No newline at end of file
+#endif // RENDERER_HPP
@@ -0,0 +1,76 @@
+#ifndef RESOLUTION_CONTROLLER_HPP
+#define RESOLUTION_CONTROLLER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// Chooses the fraction of the window size, per axis, to render at so frames take about
+// the target time. A PID controller on the relative error of the smoothed frame time,
+// whose integral holds the scale that meets the target. Errors within a tolerance count
+// as none, and the scale changes in steps, so it settles instead of resizing the
+// renderer every frame.
+class ResolutionController {
+public:
+  // target_frame_time is in seconds
+  explicit ResolutionController(double target_frame_time, float min_scale = 0.5f, float max_scale = 1.0f)
+    : m_target{target_frame_time},
+      m_min_scale{min_scale},
+      m_max_scale{max_scale},
+      m_scale{max_scale},
+      m_average{0.0},
+      m_integral{0.0},
+      m_last_error{0.0}
+  {
+    if (target_frame_time <= 0.0)
+      throw std::invalid_argument{"target_frame_time must be positive"};
+    if (min_scale <= 0.0f || min_scale > max_scale)
+      throw std::invalid_argument{"min_scale must be positive and at most max_scale"};
+  }
+
+  // should be called once per rendered frame, with the time it took. Returns the scale
+  // for the next frames.
+  auto update(double frame_time) -> float {
+    m_average = m_average == 0.0 ? frame_time : m_average + smoothing * (frame_time - m_average);
+    auto error = (m_average - m_target) / m_target; // positive when too slow
+    if (std::abs(error) < tolerance) error = 0.0;
+
+    auto derivative = error - m_last_error;
+    m_last_error = error;
+    // kept within the range it can act on, so it unwinds as soon as the error changes sign
+    m_integral = std::clamp(m_integral + error, 0.0, (double)(m_max_scale - m_min_scale) / ki);
+
+    auto output = kp * error + ki * m_integral + kd * derivative;
+    auto scale = std::clamp((double)m_max_scale - output, (double)m_min_scale, (double)m_max_scale);
+    m_scale = std::clamp((float)(std::round(scale / step) * step), m_min_scale, m_max_scale);
+    return m_scale;
+  }
+
+  auto scale() const -> float {
+    return m_scale;
+  }
+
+  auto target_frame_time() const -> double {
+    return m_target;
+  }
+
+private:
+  // Gains per frame. The cost of a frame grows with the square of the scale, so a
+  // relative error e is about a scale change of e / 2.
+  static constexpr auto kp = 0.2;
+  static constexpr auto ki = 0.05;
+  static constexpr auto kd = 0.1;
+  static constexpr auto smoothing = 0.2; // weight of the newest frame time in the average
+  static constexpr auto tolerance = 0.1; // relative error treated as none
+  static constexpr auto step = 1.0 / 32.0;
+
+  double m_target;
+  float m_min_scale;
+  float m_max_scale;
+  float m_scale;
+  double m_average; // frame time, 0 before the first update
+  double m_integral;
+  double m_last_error;
+};
+
+#endif // RESOLUTION_CONTROLLER_HPP
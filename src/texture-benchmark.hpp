@@ -0,0 +1,68 @@
+#ifndef TEXTURE_BENCHMARK_HPP
+#define TEXTURE_BENCHMARK_HPP
+
+#include "model/texture.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numbers>
+#include <print>
+#include <string>
+
+// Time to sample a texture over a screen of its size with bilinear filtering, in the
+// order the renderer walks it (tiles of 64x64 pixels, 2x2 quads row by row), with the
+// texture rotated by angle degrees. The best of a few runs, in seconds.
+// sum collects the samples so they are not optimized away.
+inline auto time_rotated_sampling(const Texture& texture, float angle, float& sum) -> double {
+  constexpr auto tile_size = 64;
+  constexpr auto runs = 3;
+  auto sampler = Sampler{.filter = TextureFilter::bilinear};
+  auto radians = angle * std::numbers::pi_v<float> / 180.0f;
+  auto cos_angle = std::cos(radians);
+  auto sin_angle = std::sin(radians);
+  auto width = texture.width();
+  auto height = texture.height();
+  auto uv = [&](int x, int y) {
+    return Vec2f{(cos_angle * (float)x - sin_angle * (float)y) / (float)width, (sin_angle * (float)x + cos_angle * (float)y) / (float)height};
+  };
+
+  auto best = std::numeric_limits<double>::max();
+  for (auto run = 0; run < runs; ++run) {
+    auto timer = Timer{};
+    for (auto tile_y = 0; tile_y < height; tile_y += tile_size) {
+      for (auto tile_x = 0; tile_x < width; tile_x += tile_size) {
+        for (auto y = tile_y; y < std::min(tile_y + tile_size, height); y += 2) {
+          for (auto x = tile_x; x < std::min(tile_x + tile_size, width); x += 2) {
+            auto texels = texture.sample_quad({uv(x, y), uv(x + 1, y), uv(x, y + 1), uv(x + 1, y + 1)}, sampler);
+            for (const auto& texel : texels) sum += texel.r;
+          }
+        }
+      }
+    }
+    best = std::min(best, timer.elapsed());
+  }
+  return best;
+}
+
+// Prints the time to sample the image with the linear and the tiled layouts, at rotations
+// where the footprint of a row of pixels moves along the rows, diagonally and down the
+// columns of the texture. Across rows the linear layout touches a cache line per texel
+// row; how much the tiled layout saves depends on how much of the texture the caches hold.
+inline auto benchmark_texture_layouts(const std::string& filepath) -> void {
+  auto linear = Texture{filepath, TextureOptions{.layout = TextureLayout::linear, .use_cache = false}};
+  auto tiled = Texture{filepath, TextureOptions{.layout = TextureLayout::tiled, .use_cache = false}};
+  std::println("Sampling {} ({}x{}) with bilinear filtering", filepath, linear.width(), linear.height());
+
+  auto sum = 0.0f;
+  for (auto angle : std::array{0.0f, 30.0f, 45.0f, 60.0f, 90.0f}) {
+    auto linear_time = time_rotated_sampling(linear, angle, sum);
+    auto tiled_time = time_rotated_sampling(tiled, angle, sum);
+    std::println("{:>3.0f} degrees: linear {:.2f} ms, tiled {:.2f} ms ({:+.1f}%)",
+      angle, linear_time * 1000.0, tiled_time * 1000.0, (tiled_time / linear_time - 1.0) * 100.0);
+  }
+  std::println("Checksum {}", sum);
+}
+
+#endif // TEXTURE_BENCHMARK_HPP